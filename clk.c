@@ -0,0 +1,132 @@
+#include <sys/types.h>
+#include <sys/time.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define HAVETSC
+#endif
+
+#include "u.h"
+#include "clk.h"
+
+enum{
+	Calibrate = 50*1000*1000,	/* ns to time the TSC against the clock */
+};
+
+static int usetsc;
+static uint64_t tsc0;
+static uint64_t mono0;
+static uint64_t mult;		/* microseconds per tick, 32.32 fixed point */
+static int64_t walloff;		/* from the clock to the time of day */
+
+static __thread uint64_t cached;
+static __thread int fresh;
+
+static uint64_t
+monons(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+#ifdef HAVETSC
+/* whether the TSC ticks at a constant rate, in all power states */
+static int
+invariant(void)
+{
+	unsigned a, b, c, d;
+
+	if(!__get_cpuid(0x80000007, &a, &b, &c, &d))
+		return 0;
+	return (d & 1<<8) != 0;
+}
+
+static int
+calibrate(void)
+{
+	struct timespec ts;
+	uint64_t t0, t1, c0, c1;
+
+	if(!invariant())
+		return -1;
+
+	t0 = monons();
+	c0 = __rdtsc();
+	ts.tv_sec = 0;
+	ts.tv_nsec = Calibrate;
+	while(nanosleep(&ts, &ts) < 0)
+		;
+	t1 = monons();
+	c1 = __rdtsc();
+	if(c1 <= c0)
+		return -1;
+
+	mult = (((unsigned __int128)(t1 - t0) << 32) / 1000) / (c1 - c0);
+	tsc0 = c1;
+	mono0 = t1 / 1000;
+	return 0;
+}
+#endif
+
+/*
+	Pick the clock, before any workers start. Returns 0 if asked
+	for the TSC and it will not do, in which case it is the
+	monotonic clock after all.
+*/
+int
+clkinit(int tsc)
+{
+	struct timeval tv;
+	int ok;
+
+	ok = 1;
+	if(tsc){
+#ifdef HAVETSC
+		usetsc = calibrate() == 0;
+#endif
+		ok = usetsc;
+	}
+
+	gettimeofday(&tv, nil);
+	walloff = tv.tv_sec*1000000LL + tv.tv_usec - (int64_t)clknow();
+	return ok;
+}
+
+uint64_t
+clknow(void)
+{
+#ifdef HAVETSC
+	if(usetsc)
+		return mono0 + (uint64_t)(((unsigned __int128)(__rdtsc() - tsc0) * mult) >> 32);
+#endif
+	return monons() / 1000;
+}
+
+uint64_t
+clk(void)
+{
+	if(!fresh){
+		cached = clknow();
+		fresh = 1;
+	}
+	return cached;
+}
+
+void
+clkstale(void)
+{
+	fresh = 0;
+}
+
+/* t as microseconds since the epoch, by the time of day at startup */
+uint64_t
+clkwall(uint64_t t)
+{
+	return t + walloff;
+}
@@ -0,0 +1,17 @@
+/*
+	Time for measuring with: microseconds on a clock that only
+	moves forward, at a steady rate, whatever NTP does to the
+	time of day. That is CLOCK_MONOTONIC, or with clkinit(1) the
+	TSC, calibrated against it, where it is invariant.
+
+	clk reads the clock once and then returns the same time until
+	clkstale says that time has moved on, so everything done for
+	one event sees one time and pays for one reading. Callbacks
+	call clkstale on entry. clknow always reads the clock.
+*/
+
+int clkinit(int tsc);
+uint64_t clknow(void);
+uint64_t clk(void);
+void clkstale(void);
+uint64_t clkwall(uint64_t t);
@@ -0,0 +1,540 @@
+/*
+    Runs spread over many hosts.
+
+    hstress -L PORT is an agent: it takes runs from controllers on
+    PORT, each in a fresh hstress of its own. hstress -C AGENTS,
+    with the usual arguments, is a controller: it hands every agent
+    in AGENTS (host:port,...) the same arguments and a time to start
+    at, and merges what comes back into one report.
+
+    They talk in lines of text. The controller sends
+
+        hstress1 INDEX NAGENTS START
+        ARG
+        ...
+        (an empty line)
+
+    START being microseconds since the epoch, a moment away; the
+    agents' clocks are taken to be kept by NTP. The agent runs
+
+        hstress -J FD,INDEX,NAGENTS,START ARG...
+
+    which takes a 1/NAGENTS share of -n, -l and -R, starts at START,
+    and at the end of each interval sends
+
+        i N COUNTERS... HIST PHASE... SIZE
+
+    N counting intervals from 0, the counters in the order of struct
+    counters and the histograms as histenc writes them, then "done"
+    once it has finished. Anything from the controller, or its going
+    away, stops the run. The agent prints its own intervals and
+    summary as usual, on its own terminal.
+
+    Interval N from every agent covers the same time, so the
+    controller adds them up, histograms and all, and prints the sum
+    stamped START plus N+1 intervals: exact percentiles across
+    hosts, not averages of each one's.
+*/
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netdb.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include <event.h>
+#include <evhttp.h>
+
+#include "u.h"
+#include "clk.h"
+#include "hist.h"
+#include "wheel.h"
+#include "hstress.h"
+
+#define MAGIC "hstress1"
+
+// the agents start this long after the controller asks them to
+#define START_USEC 2000000
+
+// intervals an agent may get ahead of the slowest
+#define NRING 32
+
+/* room for an interval: the counters, and the histograms encoded */
+#define LINESZ (64 + NCOUNTERS*21 + (2+Nphase) * (Nhist*24 + 2))
+
+/*
+    Agents.
+*/
+
+static struct event agentev;
+static int nsent;
+
+static int
+dial(char *addr)
+{
+    struct addrinfo hints, *res, *ai;
+    char *host, *port;
+    int fd, err;
+
+    host = strdup(addr);
+    if((port = strrchr(host, ':')) == nil)
+        panic("%s: want HOST:PORT", addr);
+    *port++ = '\0';
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    if((err = getaddrinfo(host, port, &hints, &res)) != 0)
+        panic("getaddrinfo %s: %s", addr, gai_strerror(err));
+    fd = -1;
+    for(ai=res; ai!=nil; ai=ai->ai_next){
+        if((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0)
+            continue;
+        if(connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    if(fd < 0)
+        panic("connect %s: %s", addr, strerror(errno));
+    freeaddrinfo(res);
+    free(host);
+    return fd;
+}
+
+/* a line from fd, up to n bytes with its newline, which is dropped */
+static char *
+readline(int fd, char *buf, int n)
+{
+    int i;
+
+    for(i=0; i<n; i++){
+        if(read(fd, &buf[i], 1) != 1)
+            return nil;
+        if(buf[i] == '\n'){
+            buf[i] = '\0';
+            return buf;
+        }
+    }
+    return nil;
+}
+
+/*
+    Options a controller may not pass on: they would write files on
+    the agent's host, or make the run an agent, a controller or a
+    server of its own.
+*/
+#define AGENTBAD "oOGLJCM"
+
+/* the first option in argv, as getopt will take them, that is in bad; or 0 */
+static int
+badopt(char **argv, int argc, char *bad)
+{
+    char *p, *o;
+    int i;
+
+    for(i=0; i<argc; i++){
+        if(argv[i][0] != '-' || argv[i][1] == '\0')
+            continue;
+        if(strcmp(argv[i], "--") == 0)
+            break;
+        for(p=argv[i]+1; *p!='\0'; p++){
+            if(strchr(bad, *p) != nil)
+                return *p;
+            // the rest, or the next argument, is this option's
+            if((o = strchr(OPTS, *p)) != nil && o[1] == ':'){
+                if(p[1] == '\0')
+                    i++;
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+    Take a run from a controller on fd, and become the hstress that
+    does it. Returns only if the controller does not make sense, or
+    asks for something it may not.
+*/
+static void
+agentrun(char *cmd, int fd)
+{
+    char line[4096], j[128], **argv;
+    int argc, idx, n, bad;
+    uint64_t start;
+
+    if(readline(fd, line, sizeof(line)) == nil
+    || sscanf(line, MAGIC " %d %d %" SCNu64, &idx, &n, &start) != 3)
+        return;
+
+    snprintf(j, sizeof(j), "%d,%d,%d,%" PRIu64, fd, idx, n, start);
+    argv = mal(3 * sizeof(char *));
+    argv[0] = cmd;
+    argv[1] = "-J";
+    argv[2] = j;
+    argc = 3;
+    for(;;){
+        if(readline(fd, line, sizeof(line)) == nil)
+            return;
+        if(line[0] == '\0')
+            break;
+        argv = remal(argv, (argc+2) * sizeof(char *));
+        argv[argc++] = strdup(line);
+    }
+    argv[argc] = nil;
+
+    if((bad = badopt(argv+3, argc-3, AGENTBAD)) != 0){
+        fprintf(stderr, "# run refused: -%c is not for agents\n", bad);
+        return;
+    }
+
+    fprintf(stderr, "# run %d of %d:", idx, n);
+    for(n=3; n<argc; n++)
+        fprintf(stderr, " %s", argv[n]);
+    fprintf(stderr, "\n");
+
+    // the agent ignores its children; this one must not
+    signal(SIGCHLD, SIG_DFL);
+    execv(cmd, argv);
+    panic("exec: %s", strerror(errno));
+}
+
+/* take runs on [ADDR:]PORT, loopback unless ADDR says otherwise */
+void
+agentd(char *where)
+{
+    struct addrinfo hints, *res;
+    char self[1024], *addr, *port;
+    int fd, c, n, err, one = 1;
+
+    // this binary, by name, so that runs look like hstress to ps
+    if((n = readlink("/proc/self/exe", self, sizeof(self)-1)) < 0)
+        panic("readlink /proc/self/exe: %s", strerror(errno));
+    self[n] = '\0';
+
+    addr = "127.0.0.1";
+    if((port = strrchr(where, ':')) != nil){
+        addr = strdup(where);
+        addr[port - where] = '\0';
+        port++;
+    }else
+        port = where;
+    if(atoi(port) <= 0)
+        panic("Invalid arguments: -L wants [ADDR:]PORT.");
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if((err = getaddrinfo(addr, port, &hints, &res)) != 0)
+        panic("getaddrinfo %s: %s", addr, gai_strerror(err));
+    if((fd = socket(res->ai_family, SOCK_STREAM, 0)) < 0)
+        panic("socket: %s", strerror(errno));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if(bind(fd, res->ai_addr, res->ai_addrlen) < 0 || listen(fd, 16) < 0)
+        panic("listen on %s:%s: %s", addr, port, strerror(errno));
+    freeaddrinfo(res);
+
+    fprintf(stderr, "# agent on %s:%s\n", addr, port);
+    signal(SIGCHLD, SIG_IGN);
+    for(;;){
+        if((c = accept(fd, nil, nil)) < 0){
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+            panic("accept: %s", strerror(errno));
+        }
+        switch(fork()){
+        case -1:
+            panic("fork: %s", strerror(errno));
+        case 0:
+            close(fd);
+            agentrun(self, c);
+            exit(1);
+        }
+        close(c);
+    }
+}
+
+/* sleep until the controller's start time */
+void
+agentwait()
+{
+    uint64_t now;
+
+    now = clkwall(clknow());
+    if(now > params.startwall){
+        fprintf(stderr, "# %.3fs late to start\n", (now - params.startwall) / 1e6);
+        return;
+    }
+    usleep(params.startwall - now);
+}
+
+static void
+agentstopcb(int fd, short what, void *arg)
+{
+    char buf[64];
+
+    // read, lest closing with it unread reset the connection
+    if(read(fd, buf, sizeof(buf)) < 0)
+        fprintf(stderr, "# controller: %s\n", strerror(errno));
+    stopworkers();
+}
+
+/* anything from the controller stops the run */
+void
+agentlisten()
+{
+    event_set(&agentev, params.agentfd, EV_READ, agentstopcb, nil);
+    event_add(&agentev, nil);
+}
+
+void
+agentsend(struct stats *st)
+{
+    static char *line;
+    uint64_t *c = (uint64_t *)&st->c;
+    char *p, *e;
+    int i;
+
+    if(line == nil)
+        line = mal(LINESZ);
+    p = line;
+    e = line + LINESZ;
+    p += snprintf(p, e-p, "i %d", nsent++);
+    for(i=0; i<NCOUNTERS; i++)
+        p += snprintf(p, e-p, " %" PRIu64, c[i]);
+    *p++ = ' ';
+    p += strlen(histenc(&st->hist, p, e-p));
+    for(i=0; i<Nphase; i++){
+        *p++ = ' ';
+        p += strlen(histenc(&st->phase[i], p, e-p));
+    }
+    *p++ = ' ';
+    p += strlen(histenc(&st->size, p, e-p));
+    *p++ = '\n';
+
+    // should the controller have gone, agentev stops the run
+    atomicio(write, params.agentfd, line, p - line);
+}
+
+/*
+    The last interval is sent. The controller hangs up once it has
+    read "done"; waiting for that, and reading whatever else it sent,
+    means the connection is not reset with "done" still on its way.
+*/
+void
+agentdone()
+{
+    char buf[64];
+
+    event_del(&agentev);
+    atomicio(write, params.agentfd, "done\n", 5);
+    shutdown(params.agentfd, SHUT_WR);
+    while(read(params.agentfd, buf, sizeof(buf)) > 0)
+        ;
+    close(params.agentfd);
+}
+
+/*
+    The controller.
+*/
+
+typedef struct agent agent;
+
+struct agent{
+    char            *addr;
+    int             fd;
+    struct event    ev;
+    struct evbuffer *in;
+    int             next;       /* the interval it sends next */
+    int             done;
+};
+
+static agent *agents;
+static int nagents;
+
+/* intervals not yet in from every agent */
+static struct{
+    struct stats    st;
+    int             n;
+} ring[NRING];
+static int next;
+static uint64_t startwall;
+
+/* add an interval line from a; -1 if it is not one */
+static int
+takeinterval(agent *a, char *line)
+{
+    struct stats *st;
+    uint64_t *c;
+    char *f;
+    int i, k;
+
+    if(strsep(&line, " ") == nil || (f = strsep(&line, " ")) == nil)
+        return -1;
+    if((k = atoi(f)) != a->next)
+        return -1;
+    if(k >= next + NRING)
+        panic("agent %s: %d intervals ahead", a->addr, k - next);
+    a->next++;
+
+    st = &ring[k % NRING].st;
+    c = (uint64_t *)&st->c;
+    ring[k % NRING].n++;
+    for(i=0; i<NCOUNTERS; i++){
+        if((f = strsep(&line, " ")) == nil)
+            return -1;
+        c[i] += strtoull(f, nil, 10);
+    }
+    if((f = strsep(&line, " ")) == nil || histdec(&st->hist, f) < 0)
+        return -1;
+    for(i=0; i<Nphase; i++)
+        if((f = strsep(&line, " ")) == nil || histdec(&st->phase[i], f) < 0)
+            return -1;
+    if((f = strsep(&line, " ")) == nil || histdec(&st->size, f) < 0)
+        return -1;
+    return 0;
+}
+
+/* print intervals that every agent has sent, or finished before */
+static void
+flush()
+{
+    uint64_t usec;
+    int i, more;
+
+    usec = reporttv.tv_sec * 1000000ULL;
+    for(;;){
+        more = 0;
+        for(i=0; i<nagents; i++){
+            if(!agents[i].done && agents[i].next <= next)
+                return;
+            if(agents[i].next > next)
+                more = 1;
+        }
+        if(!more)
+            return;
+        printinterval(startwall / 1000000 + (next+1) * reporttv.tv_sec, &ring[next % NRING].st, usec);
+        merge(&counts, &ring[next % NRING].st);
+        warmup(&ring[next % NRING].st, usec);
+        memset(&ring[next % NRING], 0, sizeof(ring[0]));
+        next++;
+    }
+}
+
+static void
+gone(agent *a)
+{
+    a->done = 1;
+    event_del(&a->ev);
+    close(a->fd);
+}
+
+static void
+agentcb(int fd, short what, void *arg)
+{
+    agent *a = arg;
+    char *line;
+    int i, n;
+
+    n = evbuffer_read(a->in, fd, -1);
+    while(!a->done && (line = evbuffer_readln(a->in, nil, EVBUFFER_EOL_LF)) != nil){
+        if(strcmp(line, "done") == 0)
+            gone(a);
+        else if(takeinterval(a, line) < 0)
+            panic("agent %s: bad interval", a->addr);
+        free(line);
+    }
+    if(n <= 0 && !a->done){
+        fprintf(stderr, "# agent %s: lost after %d intervals\n", a->addr, a->next);
+        gone(a);
+    }
+    flush();
+
+    for(i=0; i<nagents; i++)
+        if(!agents[i].done)
+            return;
+    report();
+    exit(0);
+}
+
+/* the first interrupt stops the agents; a second does not wait for them */
+static void
+ctlsigint(int which)
+{
+    int i;
+
+    if(stopping++){
+        report();
+        exit(0);
+    }
+    for(i=0; i<nagents; i++)
+        if(!agents[i].done)
+            atomicio(write, agents[i].fd, "stop\n", 5);
+}
+
+/* run argv, less -C, -M and -G, which are the controller's, on every agent in list */
+void
+controller(char *list, char **argv, int argc)
+{
+    struct event_base *base;
+    char *p, *s, hdr[128];
+    agent *a;
+    int i, j;
+
+    for(s=list; (p = strsep(&s, ",")) != nil;){
+        if(*p == '\0')
+            continue;
+        agents = remal(agents, (nagents+1) * sizeof(agent));
+        memset(&agents[nagents], 0, sizeof(agent));
+        agents[nagents++].addr = p;
+    }
+    if(nagents == 0)
+        panic("Invalid arguments: -C (AGENTS) names none.");
+
+    clkinit(0);
+    base = event_init();
+    if(params.metrics != nil)
+        mkmetrics(base, params.metrics);
+    signal(SIGINT, ctlsigint);
+
+    startwall = clkwall(clknow()) + START_USEC;
+    runstart = startwall - clkwall(0);
+
+    for(i=0; i<nagents; i++){
+        a = &agents[i];
+        a->fd = dial(a->addr);
+        snprintf(hdr, sizeof(hdr), MAGIC " %d %d %" PRIu64 "\n", i, nagents, startwall);
+        atomicio(write, a->fd, hdr, strlen(hdr));
+        for(j=1; j<argc; j++){
+            if(argv[j][0] == '-' && argv[j][1] != '\0' && strchr("CMG", argv[j][1]) != nil){
+                if(argv[j][2] == '\0')
+                    j++;
+                continue;
+            }
+            if(strchr(argv[j], '\n') != nil)
+                panic("Invalid arguments: \"%s\" has a newline.", argv[j]);
+            atomicio(write, a->fd, argv[j], strlen(argv[j]));
+            atomicio(write, a->fd, "\n", 1);
+        }
+        atomicio(write, a->fd, "\n", 1);
+
+        a->in = evbuffer_new();
+        event_set(&a->ev, a->fd, EV_READ | EV_PERSIST, agentcb, a);
+        event_add(&a->ev, nil);
+    }
+
+    fprintf(stderr, "# controller: %d agents, starting in %.1fs\n", nagents, START_USEC / 1e6);
+    header();
+    event_dispatch();
+    exit(0);
+}
@@ -0,0 +1,804 @@
+/*
+    An HTTP/2 engine for hstress, with -E h2: cleartext, by prior
+    knowledge (h2c, with no Upgrade first), for servers that take it.
+
+    Each runner's connection carries up to params.depth requests at
+    once (-P), each on a stream of its own, as many as the server
+    allows; the rest wait for a stream in the order sent. Each is
+    timed from when it was sent until its stream ended, however the
+    others on the connection fared. A timeout cancels just its own
+    stream, unless nothing at all has come from the server since it
+    was sent, when the connection goes with everything on it.
+
+    Header blocks go out as tmpl.c made them, and bodies are copied
+    into DATA frames as the server's windows allow. Responses are
+    decoded for :status and otherwise dropped, summed first with -x.
+    We offer the largest windows there are and top the connection's
+    up as we go, so the server is never held back on our account.
+*/
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <event.h>
+#include <evhttp.h>
+
+#include "u.h"
+#include "clk.h"
+#include "hist.h"
+#include "wheel.h"
+#include "hstress.h"
+#include "hpack.h"
+
+/* must hold a whole frame, which the server keeps to H2minframe */
+#define H2BUF 65536
+
+/* how much DATA to queue ahead of the socket */
+#define H2OUT 65536
+
+/* DATA taken before the connection's window is topped up again */
+#define H2TOPUP (1ULL << 30)
+
+/* stream ids are 31 bits; a connection near the end of them is replaced */
+#define H2LASTID 0x7ff00000
+
+struct stream{
+    uint32_t        id;             /* 0 if free */
+    struct request  *req;
+    int64_t         window;         /* the server's, for our DATA */
+    size_t          sent;           /* of the request body */
+};
+
+struct h2conn{
+    runner          *run;
+    int             fd;
+    int             gen;            /* bumped as fd comes and goes */
+    int             connecting;
+    int             err;            /* failed; h2writecb reports it */
+    int             inread;         /* h2readcb flushes when done */
+    uint64_t        readat;         /* clk, at the last read; 0 before any */
+    struct event    rev;
+    struct event    wev;
+
+    /*
+        Open streams, params.depth of them, each in the slot its id
+        picks; new ids skip past slots still taken.
+    */
+    struct stream   *streams;
+    int             nstreams;
+    int             sending;        /* streams with some of their body still to send */
+    uint32_t        nextid;
+    int             goaway;         /* no new streams: the server said, or ids ran out */
+
+    /* the server's settings, and its window for our DATA */
+    int             maxstreams;
+    int             maxframe;
+    int64_t         initwindow;
+    int64_t         window;
+    uint64_t        unacked;        /* DATA taken since we last topped up */
+
+    /* requests waiting for a stream, in a ring of params.depth */
+    struct request  **wait;
+    int             whead;
+    int             nwait;
+
+    /* a header block, which may come in pieces */
+    Hpack           hp;
+    unsigned char   *hdr;
+    int             hlen;
+    int             hsz;
+    uint32_t        hid;            /* its stream, while more is to come */
+    int             hflags;
+    int             status;         /* its :status */
+
+    /* frames to write */
+    unsigned char   *out;
+    int             opos;
+    int             olen;
+    int             osz;
+
+    struct request  **dead;         /* h2abort's */
+    int             rpos;
+    int             rlen;
+    unsigned char   buf[H2BUF];
+};
+
+static struct sockaddr_storage addr;
+static socklen_t addrlen;
+
+static void h2readcb(int fd, short what, void *arg);
+static void h2writecb(int fd, short what, void *arg);
+static void h2pump(runner *run);
+
+static void
+h2init(void)
+{
+    targetaddr(&addr, &addrlen);
+}
+
+/* room for n more bytes to write; they are counted in when written there */
+static unsigned char *
+h2room(struct h2conn *c, int n)
+{
+    if(c->olen + n > c->osz && c->opos > 0){
+        memmove(c->out, c->out + c->opos, c->olen - c->opos);
+        c->olen -= c->opos;
+        c->opos = 0;
+    }
+    if(c->olen + n > c->osz){
+        c->osz = c->olen + n + H2OUT;
+        c->out = remal(c->out, c->osz);
+    }
+    return c->out + c->olen;
+}
+
+/* queue a frame of n bytes from p, which may be nil for none */
+static void
+h2frame(struct h2conn *c, int type, int flags, uint32_t id, void *p, int n)
+{
+    unsigned char *q;
+
+    q = h2room(c, H2hdrlen + n);
+    h2put(q, n, type, flags, id);
+    if(n > 0)
+        memcpy(q + H2hdrlen, p, n);
+    c->olen += H2hdrlen + n;
+}
+
+static void
+h2u32frame(struct h2conn *c, int type, uint32_t id, uint32_t v)
+{
+    unsigned char b[4];
+
+    h2put32(b, v);
+    h2frame(c, type, 0, id, b, 4);
+}
+
+static void
+h2open(runner *run)
+{
+    struct h2conn *c;
+    unsigned char b[12];
+    int fd, one = 1;
+
+    if(run->h2 == nil){
+        if((run->h2 = calloc(1, sizeof(struct h2conn))) == nil)
+            panic("calloc");
+        c = run->h2;
+        c->streams = calloc(params.depth, sizeof(struct stream));
+        c->wait = calloc(params.depth, sizeof(struct request *));
+        c->dead = calloc(params.depth, sizeof(struct request *));
+        if(c->streams == nil || c->wait == nil || c->dead == nil)
+            panic("calloc");
+        c->run = run;
+        c->fd = -1;
+    }
+    c = run->h2;
+
+    if((fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0)
+        panic("socket: %s", strerror(errno));
+    if(addr.ss_family != AF_UNIX)
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    bindsrc(run->w, fd);
+
+    c->fd = fd;
+    c->gen++;
+    c->connecting = 1;
+    c->err = 0;
+    c->readat = 0;
+    c->rpos = c->rlen = 0;
+    c->opos = c->olen = 0;
+    c->hid = 0;
+    c->nextid = 1;
+    c->goaway = 0;
+    c->maxstreams = params.depth;
+    c->maxframe = H2minframe;
+    c->initwindow = c->window = H2defwindow;
+    c->unacked = 0;
+    hpackinit(&c->hp);
+    connecting(run);
+
+    // the preface, no pushes, and all the window there is
+    memcpy(h2room(c, sizeof(H2PREFACE)-1), H2PREFACE, sizeof(H2PREFACE)-1);
+    c->olen += sizeof(H2PREFACE)-1;
+    h2setting(b, H2enablepush, 0);
+    h2setting(b+6, H2initwindow, H2maxwindow);
+    h2frame(c, H2settings, 0, 0, b, 12);
+    h2u32frame(c, H2window, 0, H2maxwindow - H2defwindow);
+
+    if(connect(fd, (struct sockaddr *)&addr, addrlen) < 0){
+        if(errno != EINPROGRESS)
+            c->err = errno;
+    }else{
+        c->connecting = 0;
+        connected(run);
+    }
+
+    event_set(&c->rev, fd, EV_READ | EV_PERSIST, h2readcb, run);
+    event_base_set(run->w->base, &c->rev);
+    event_add(&c->rev, nil);
+    event_set(&c->wev, fd, EV_WRITE, h2writecb, run);
+    event_base_set(run->w->base, &c->wev);
+    if(c->err)
+        event_active(&c->wev, EV_WRITE, 1);
+    else
+        event_add(&c->wev, nil);
+}
+
+static void
+h2close(runner *run)
+{
+    struct h2conn *c = run->h2;
+
+    if(c == nil || c->fd < 0)
+        return;
+
+    churnclose(c->fd);
+    event_del(&c->rev);
+    event_del(&c->wev);
+    close(c->fd);
+    c->fd = -1;
+    c->gen++;
+    hpackfree(&c->hp);
+    bump(run->w->stats->c.conn_closes);
+}
+
+static struct request *
+h2newreq(runner *run)
+{
+    return reqalloc(run->w);
+}
+
+static void
+h2freereq(runner *run, struct request *req)
+{
+    reqfree(run->w, req);
+}
+
+static struct stream *
+h2stream(struct h2conn *c, uint32_t id)
+{
+    struct stream *s;
+
+    if(id == 0)
+        return nil;
+    s = &c->streams[(id >> 1) % params.depth];
+    return s->id == id ? s : nil;
+}
+
+/* queue as much of s's body as the windows allow */
+static void
+h2data(struct h2conn *c, struct stream *s)
+{
+    struct tmpl *t = &tmpls[s->req->tmpl];
+    int64_t n;
+
+    while(s->sent < t->bodylen && c->olen - c->opos < H2OUT){
+        n = t->bodylen - s->sent;
+        n = n < c->maxframe ? n : c->maxframe;
+        n = n < c->window ? n : c->window;
+        n = n < s->window ? n : s->window;
+        if(n <= 0)
+            return;
+        h2frame(c, H2data, s->sent + n == t->bodylen ? H2endstream : 0, s->id, t->body + s->sent, n);
+        s->sent += n;
+        c->window -= n;
+        s->window -= n;
+        if(s->sent == t->bodylen)
+            c->sending--;
+    }
+}
+
+/* give req a stream, and queue its headers */
+static void
+h2start(struct h2conn *c, struct request *req)
+{
+    struct tmpl *t = &tmpls[req->tmpl];
+    struct stream *s;
+    unsigned char *p;
+
+    while(c->streams[(c->nextid >> 1) % params.depth].id != 0)
+        c->nextid += 2;
+    s = &c->streams[(c->nextid >> 1) % params.depth];
+    s->id = c->nextid;
+    s->req = req;
+    s->window = c->initwindow;
+    s->sent = 0;
+    c->nstreams++;
+    c->nextid += 2;
+    if(c->nextid > H2LASTID)
+        c->goaway = 1;
+
+    p = h2room(c, t->rawlen);
+    memcpy(p, t->raw, t->rawlen);
+    if(t->bodylen == 0)
+        p[4] |= H2endstream;
+    else
+        c->sending++;
+    h2put32(p+5, s->id);
+    c->olen += t->rawlen;
+}
+
+/* write what we can; returns -1 if the connection failed */
+static int
+h2flush(runner *run)
+{
+    struct h2conn *c = run->h2;
+    ssize_t n;
+
+    while(c->opos < c->olen){
+        n = write(c->fd, c->out + c->opos, c->olen - c->opos);
+        if(n < 0){
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN){
+                event_add(&c->wev, nil);
+                return 0;
+            }
+            return -1;
+        }
+        c->opos += n;
+        add(run->w->stats->c.bytes_sent, n);
+    }
+    c->opos = c->olen = 0;
+    return 0;
+}
+
+/*
+    Give waiting requests streams, send what bodies we can, and
+    write it all out, unless responses are being read, when it goes
+    out together once the read is done. Failures are reported from
+    the event loop rather than from here, where complete() would
+    call straight back into us.
+*/
+static void
+h2pump(runner *run)
+{
+    struct h2conn *c = run->h2;
+    int i;
+
+    if(c->fd < 0)
+        return;
+
+    // a connection that takes no new streams goes once its last is done
+    if(c->goaway && c->nstreams == 0 && c->nwait > 0){
+        h2close(run);
+        h2open(run);
+    }
+    while(c->nwait > 0 && !c->goaway && c->nstreams < c->maxstreams){
+        h2start(c, c->wait[c->whead]);
+        c->whead = (c->whead + 1) % params.depth;
+        c->nwait--;
+    }
+    for(i=0; c->sending > 0 && i<params.depth && c->olen - c->opos < H2OUT; i++)
+        if(c->streams[i].id != 0)
+            h2data(c, &c->streams[i]);
+
+    if(!c->connecting && !c->inread && h2flush(run) < 0){
+        c->err = errno;
+        event_active(&c->wev, EV_WRITE, 1);
+    }
+}
+
+static void
+h2send(runner *run, struct request *req)
+{
+    struct h2conn *c = run->h2;
+
+    // the server may have closed an idle connection since
+    if(c->fd < 0)
+        h2open(run);
+    c->wait[(c->whead + c->nwait++) % params.depth] = req;
+    h2pump(run);
+}
+
+/* free s's slot; returns its request, for complete() */
+static struct request *
+h2release(struct h2conn *c, struct stream *s, int how)
+{
+    struct request *req = s->req;
+
+    if(s->sent < tmpls[req->tmpl].bodylen){
+        // answered before we finished asking
+        if(how == Success)
+            h2u32frame(c, H2rst, s->id, 0);
+        c->sending--;
+    }
+    s->id = 0;
+    s->req = nil;
+    c->nstreams--;
+    return req;
+}
+
+/* s's request is done; hand it back */
+static void
+h2done(runner *run, struct stream *s, int how)
+{
+    complete(how, h2release(run->h2, s, how));
+}
+
+/*
+    The connection is gone: everything on a stream failed, but for
+    expired, which timed out. Requests still waiting for a stream
+    were never sent, and wait on for the next connection.
+*/
+static void
+h2abort(runner *run, struct request *expired)
+{
+    struct h2conn *c = run->h2;
+    int i, n;
+
+    h2close(run);
+
+    n = 0;
+    for(i=0; i<params.depth; i++)
+        if(c->streams[i].id != 0){
+            c->dead[n++] = c->streams[i].req;
+            c->streams[i].id = 0;
+        }
+    c->nstreams = c->sending = 0;
+
+    for(i=0; i<n; i++)
+        complete(c->dead[i] == expired ? Timeout : Error, c->dead[i]);
+    if(c->fd < 0 && c->nwait > 0)
+        h2open(run);
+    h2pump(run);
+}
+
+static void
+h2fail(runner *run)
+{
+    h2abort(run, nil);
+}
+
+static void
+h2expire(struct request *req)
+{
+    runner *run = req->run;
+    struct h2conn *c = run->h2;
+    struct stream *s;
+    int i, j;
+
+    for(i=0; i<c->nwait; i++){
+        j = (c->whead + i) % params.depth;
+        if(c->wait[j] != req)
+            continue;
+        for(; i<c->nwait-1; i++, j=(j+1)%params.depth)
+            c->wait[j] = c->wait[(j+1) % params.depth];
+        c->nwait--;
+        complete(Timeout, req);
+        return;
+    }
+
+    // the server has not said a thing since; it is not just this stream
+    if(c->readat < req->start){
+        h2abort(run, req);
+        return;
+    }
+
+    for(i=0; i<params.depth; i++){
+        s = &c->streams[i];
+        if(s->id != 0 && s->req == req){
+            h2u32frame(c, H2rst, s->id, H2cancel);
+            h2done(run, s, Timeout);
+            h2pump(run);
+            return;
+        }
+    }
+}
+
+static void
+h2writecb(int fd, short what, void *arg)
+{
+    runner *run = (runner *)arg;
+    struct h2conn *c = run->h2;
+    socklen_t len;
+    int err;
+
+    clkstale();
+    if(c->err){
+        h2fail(run);
+        return;
+    }
+
+    if(c->connecting){
+        len = sizeof(err);
+        if(getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0){
+            h2fail(run);
+            return;
+        }
+        c->connecting = 0;
+        connected(run);
+    }
+    if(h2flush(run) < 0)
+        h2fail(run);
+    else if(c->opos == c->olen)
+        h2pump(run);
+}
+
+static void
+h2field(void *arg, char *name, int nlen, char *value, int vlen)
+{
+    struct h2conn *c = arg;
+    int i;
+
+    if(nlen != 7 || memcmp(name, ":status", 7) != 0)
+        return;
+    c->status = 0;
+    for(i=0; i<vlen && value[i] >= '0' && value[i] <= '9'; i++)
+        c->status = c->status*10 + value[i] - '0';
+}
+
+/* a header block is all here */
+static int
+h2headers(runner *run)
+{
+    struct h2conn *c = run->h2;
+    struct stream *s;
+
+    s = h2stream(c, c->hid);
+    c->hid = 0;
+    c->status = -1;
+    if(hpackdec(&c->hp, c->hdr, c->hlen, h2field, c) < 0)
+        return -1;
+    if(s == nil)
+        return 0;
+
+    // informational responses come before the real one, trailers after
+    s->req->size += c->hlen;
+    if(c->status >= 200 && s->req->status < 0)
+        s->req->status = c->status;
+    if(c->hflags & H2endstream)
+        h2done(run, s, Success);
+    return 0;
+}
+
+static void
+h2hdr(struct h2conn *c, unsigned char *p, int n)
+{
+    if(c->hlen + n > c->hsz){
+        c->hsz = c->hlen + n + 4096;
+        c->hdr = remal(c->hdr, c->hsz);
+    }
+    memcpy(c->hdr + c->hlen, p, n);
+    c->hlen += n;
+}
+
+/* strip f's padding from what p and n say is its payload */
+static int
+h2unpad(H2frame *f, unsigned char **p, int *n)
+{
+    *n = f->len;
+    if(f->flags & H2padded){
+        if(*n < 1 || **p >= *n)
+            return -1;
+        *n -= 1 + **p;
+        (*p)++;
+    }
+    return 0;
+}
+
+/* act on a frame; -1 if the server broke the protocol */
+static int
+h2input(runner *run, H2frame *f, unsigned char *p)
+{
+    struct h2conn *c = run->h2;
+    struct stream *s;
+    struct request *req;
+    int64_t delta;
+    uint32_t v;
+    int i, n;
+
+    s = h2stream(c, f->id);
+
+    // nothing may come between the pieces of a header block
+    if(c->hid != 0 && f->type != H2continuation)
+        return -1;
+
+    switch(f->type){
+    case H2data:
+        c->unacked += f->len;
+        if(c->unacked >= H2TOPUP){
+            h2u32frame(c, H2window, 0, c->unacked);
+            c->unacked = 0;
+        }
+        if(h2unpad(f, &p, &n) < 0)
+            return -1;
+        if(s == nil)
+            break;
+        req = s->req;
+        if(req->first == 0)
+            req->first = clk();
+        req->size += n;
+        if(params.checksum)
+            req->sum = bodysum(req->sum, (char *)p, n);
+        if(f->flags & H2endstream)
+            h2done(run, s, Success);
+        break;
+
+    case H2headers:
+        if(h2unpad(f, &p, &n) < 0)
+            return -1;
+        if(f->flags & H2priorityflag){
+            if(n < 5)
+                return -1;
+            p += 5;
+            n -= 5;
+        }
+        if(s != nil && s->req->first == 0)
+            s->req->first = clk();
+        c->hlen = 0;
+        h2hdr(c, p, n);
+        c->hid = f->id;
+        c->hflags = f->flags;
+        if(f->flags & H2endheaders)
+            return h2headers(run);
+        break;
+
+    case H2continuation:
+        if(c->hid == 0 || f->id != c->hid)
+            return -1;
+        h2hdr(c, p, f->len);
+        if(f->flags & H2endheaders)
+            return h2headers(run);
+        break;
+
+    case H2rst:
+        if(s != nil)
+            h2done(run, s, Error);
+        break;
+
+    case H2settings:
+        if(f->flags & H2ack)
+            break;
+        if(f->len % 6 != 0)
+            return -1;
+        for(i=0; i<f->len; i+=6){
+            v = h2u32(p+i+2);
+            switch(p[i] << 8 | p[i+1]){
+            case H2maxstreams:
+                c->maxstreams = v < params.depth ? v : params.depth;
+                break;
+            case H2initwindow:
+                if(v > H2maxwindow)
+                    return -1;
+                delta = (int64_t)v - c->initwindow;
+                for(n=0; n<params.depth; n++)
+                    c->streams[n].window += delta;
+                c->initwindow = v;
+                break;
+            case H2maxframe:
+                if(v < H2minframe || v > 0xffffff)
+                    return -1;
+                c->maxframe = v;
+                break;
+            }
+        }
+        h2frame(c, H2settings, H2ack, 0, nil, 0);
+        break;
+
+    case H2ping:
+        if(f->len != 8)
+            return -1;
+        if(!(f->flags & H2ack))
+            h2frame(c, H2ping, H2ack, 0, p, 8);
+        break;
+
+    case H2goaway:
+        // streams after the last it names will not be answered
+        if(f->len < 8)
+            return -1;
+        v = h2u32(p) & 0x7fffffff;
+        c->goaway = 1;
+
+        // clear their slots first: completing one may reopen c and
+        // start the new connection's streams in slots not yet visited
+        n = 0;
+        for(i=0; i<params.depth; i++)
+            if(c->streams[i].id > v)
+                c->dead[n++] = h2release(c, &c->streams[i], Error);
+        for(i=0; i<n; i++)
+            complete(Error, c->dead[i]);
+        break;
+
+    case H2window:
+        if(f->len != 4)
+            return -1;
+        v = h2u32(p) & 0x7fffffff;
+        if(f->id == 0)
+            c->window += v;
+        else if(s != nil)
+            s->window += v;
+        break;
+
+    case H2push:
+        // we said not to
+        return -1;
+    }
+    return 0;
+}
+
+/*
+    Act on each whole frame buffered. Returns -1 on a protocol
+    error, otherwise 0 once it needs more input.
+*/
+static int
+h2parse(runner *run)
+{
+    struct h2conn *c = run->h2;
+    unsigned char *p;
+    H2frame f;
+    int gen;
+
+    gen = c->gen;
+    while(c->gen == gen && c->rlen - c->rpos >= H2hdrlen){
+        p = c->buf + c->rpos;
+        h2get(p, &f);
+        if(f.len > H2minframe)
+            return -1;
+        if(c->rlen - c->rpos < H2hdrlen + f.len)
+            break;
+        c->rpos += H2hdrlen + f.len;
+        if(h2input(run, &f, p + H2hdrlen) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static void
+h2readcb(int fd, short what, void *arg)
+{
+    runner *run = (runner *)arg;
+    struct h2conn *c = run->h2;
+    int n;
+
+    clkstale();
+    if(c->rpos == c->rlen)
+        c->rpos = c->rlen = 0;
+    else if(c->rpos > 0){
+        memmove(c->buf, c->buf + c->rpos, c->rlen - c->rpos);
+        c->rlen -= c->rpos;
+        c->rpos = 0;
+    }
+
+    n = read(fd, c->buf + c->rlen, sizeof(c->buf) - c->rlen);
+    if(n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if(n <= 0){
+        h2fail(run);
+        return;
+    }
+    c->rlen += n;
+    c->readat = clk();
+
+    c->inread = 1;
+    n = h2parse(run);
+    c->inread = 0;
+    if(n < 0){
+        h2fail(run);
+        return;
+    }
+    h2pump(run);
+}
+
+struct engine h2engine = {
+    "h2",
+    h2init,
+    h2open,
+    h2close,
+    h2newreq,
+    h2freereq,
+    h2send,
+    h2expire,
+};
@@ -0,0 +1,306 @@
+/*
+    Latency heatmaps, with -G. The aggregator keeps each interval's
+    latency histogram, as it prints it, folded onto coarse log-scaled
+    bins (Hsteps to an octave, so each about 9% wide), and at the end
+    of the run writes them out as a matrix of time by latency:
+
+        FILE        TSV: a row per interval, a column per bin
+        FILE.svg    the same drawn as a heatmap
+        FILE.html   that drawing as a page of its own
+
+    The pictures have the intervals' p50 and p99 drawn over them.
+    Only the span of bins the run used is written.
+*/
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <event.h>
+#include <evhttp.h>
+
+#include "u.h"
+#include "clk.h"
+#include "hist.h"
+#include "wheel.h"
+#include "hstress.h"
+
+enum{
+    Hsteps = 8,
+    Nheat = Hmaxbits*Hsteps + 1,
+};
+
+enum{
+    Tsv,
+    Svg,
+    Html,
+};
+
+struct row{
+    int ts;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t n[Nheat];
+};
+
+static struct row *rows;
+static int nrows;
+
+static struct{
+    FILE *f;
+    int kind;
+} outs[4];
+static int nouts;
+
+/* the bins used, lo to hi, and the most any cell holds */
+static int lo, hi;
+static uint64_t most;
+
+/* the bin for v microseconds; 0 has 0 and 1 */
+static int
+heatidx(double v)
+{
+    if(v < 1)
+        return 0;
+    return (int)(log2(v) * Hsteps);
+}
+
+/* the lowest value in bin b */
+static double
+heatlo(int b)
+{
+    return b == 0 ? 0 : exp2((double)b / Hsteps);
+}
+
+void
+heatfile(char *path)
+{
+    char *p;
+    int kind;
+
+    if(nouts == sizeof(outs)/sizeof(outs[0]))
+        panic("Invalid arguments: too many -G files.");
+    kind = Tsv;
+    if((p = strrchr(path, '.')) != nil){
+        if(strcasecmp(p, ".svg") == 0)
+            kind = Svg;
+        else if(strcasecmp(p, ".html") == 0 || strcasecmp(p, ".htm") == 0)
+            kind = Html;
+    }
+    if((outs[nouts].f = fopen(path, "w")) == nil)
+        panic("open %s: %s", path, strerror(errno));
+    outs[nouts++].kind = kind;
+}
+
+/* keep h, the interval stamped ts */
+void
+heatnote(int ts, Hist *h)
+{
+    struct row *r;
+    int i;
+
+    if(nouts == 0)
+        return;
+    if(nrows % 64 == 0)
+        rows = remal(rows, (nrows+64) * sizeof(struct row));
+    r = &rows[nrows++];
+    memset(r, 0, sizeof(*r));
+    r->ts = ts;
+    r->p50 = histpct(h, 50);
+    r->p99 = histpct(h, 99);
+    for(i=0; i<Nhist; i++)
+        if(h->n[i] != 0)
+            r->n[heatidx(histmid(i))] += h->n[i];
+}
+
+static void
+writetsv(FILE *f)
+{
+    int i, b;
+
+    fprintf(f, "time");
+    for(b=lo; b<=hi; b++)
+        fprintf(f, "\t%.4g", heatlo(b)/1000);
+    fprintf(f, "\n");
+    for(i=0; i<nrows; i++){
+        fprintf(f, "%d", rows[i].ts);
+        for(b=lo; b<=hi; b++)
+            fprintf(f, "\t%" PRIu64, rows[i].n[b]);
+        fprintf(f, "\n");
+    }
+}
+
+/* light yellow through orange to dark red, as x goes from 0 to 1 */
+static void
+color(double x, char *buf, size_t n)
+{
+    static int stop[3][3] = {
+        { 255, 255, 204 },
+        { 253, 141, 60 },
+        { 128, 0, 38 },
+    };
+    int *a, *b, k;
+
+    k = x < 0.5 ? 0 : 1;
+    a = stop[k];
+    b = stop[k+1];
+    x = x < 0.5 ? 2*x : 2*x - 1;
+    snprintf(buf, n, "#%02x%02x%02x",
+        (int)(a[0] + (b[0]-a[0])*x), (int)(a[1] + (b[1]-a[1])*x), (int)(a[2] + (b[2]-a[2])*x));
+}
+
+enum{
+    Left = 70,
+    Top = 30,
+    Right = 20,
+    Bottom = 40,
+};
+
+static double cw, ch;
+
+static double
+ypos(double v)
+{
+    double pos;
+
+    pos = (v < 1 ? 0 : log2(v) * Hsteps) - lo;
+    return Top + (hi - lo + 1 - pos) * ch;
+}
+
+static void
+polyline(FILE *f, int p99, char *style)
+{
+    uint64_t v;
+    int i;
+
+    fprintf(f, "<polyline fill=\"none\" %s points=\"", style);
+    for(i=0; i<nrows; i++){
+        v = p99 ? rows[i].p99 : rows[i].p50;
+        if(v != 0)
+            fprintf(f, " %.1f,%.1f", Left + (i+0.5)*cw, ypos(v));
+    }
+    fprintf(f, "\"/>\n");
+}
+
+static void
+writesvg(FILE *f)
+{
+    char fill[16];
+    double w, h, y, v;
+    int i, b, step;
+
+    cw = 800.0 / nrows;
+    cw = cw < 1 ? 1 : cw > 40 ? 40 : cw;
+    ch = 400.0 / (hi - lo + 1);
+    ch = ch < 2 ? 2 : ch > 12 ? 12 : ch;
+    w = cw * nrows;
+    h = ch * (hi - lo + 1);
+
+    fprintf(f, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%.0f\" height=\"%.0f\" "
+        "font-family=\"sans-serif\" font-size=\"11\">\n", Left + (w > 360 ? w : 360) + Right, Top + h + Bottom);
+    fprintf(f, "<text x=\"%d\" y=\"%d\" font-size=\"13\">latency over time: %d intervals, "
+        "<tspan fill=\"#1f4e99\">p50</tspan> and <tspan fill=\"#000\">p99</tspan></text>\n",
+        Left, Top - 12, nrows);
+    fprintf(f, "<rect x=\"%d\" y=\"%d\" width=\"%.1f\" height=\"%.1f\" fill=\"#fff\" stroke=\"#999\"/>\n",
+        Left, Top, w, h);
+
+    for(i=0; i<nrows; i++)
+        for(b=lo; b<=hi; b++){
+            if(rows[i].n[b] == 0)
+                continue;
+            color(log1p(rows[i].n[b]) / log1p(most), fill, sizeof(fill));
+            fprintf(f, "<rect x=\"%.1f\" y=\"%.1f\" width=\"%.1f\" height=\"%.1f\" fill=\"%s\">"
+                "<title>%+ds, %.4g-%.4g ms: %" PRIu64 "</title></rect>\n",
+                Left + i*cw, Top + (hi - b)*ch, cw, ch, fill,
+                rows[i].ts - rows[0].ts, heatlo(b)/1000, heatlo(b+1)/1000, rows[i].n[b]);
+        }
+
+    polyline(f, 0, "stroke=\"#1f4e99\" stroke-width=\"1.5\"");
+    polyline(f, 1, "stroke=\"#000\" stroke-width=\"1.5\" stroke-dasharray=\"4,2\"");
+
+    // latency at each power of ten, in milliseconds
+    for(v=1; v<=heatlo(hi+1); v*=10){
+        if(v < heatlo(lo))
+            continue;
+        y = ypos(v);
+        fprintf(f, "<line x1=\"%d\" y1=\"%.1f\" x2=\"%d\" y2=\"%.1f\" stroke=\"#999\"/>"
+            "<text x=\"%d\" y=\"%.1f\" text-anchor=\"end\">%g ms</text>\n",
+            Left - 4, y, Left, y, Left - 6, y + 4, v/1000);
+    }
+
+    // seconds since the first interval, about ten of them
+    step = nrows > 10 ? nrows / 10 : 1;
+    for(i=0; i<nrows; i+=step)
+        fprintf(f, "<line x1=\"%.1f\" y1=\"%.1f\" x2=\"%.1f\" y2=\"%.1f\" stroke=\"#999\"/>"
+            "<text x=\"%.1f\" y=\"%.1f\" text-anchor=\"middle\">%ds</text>\n",
+            Left + (i+0.5)*cw, Top + h, Left + (i+0.5)*cw, Top + h + 4,
+            Left + (i+0.5)*cw, Top + h + 16, rows[i].ts - rows[0].ts);
+    fprintf(f, "</svg>\n");
+}
+
+static void
+writehtml(FILE *f)
+{
+    char when[64];
+    time_t t;
+
+    t = rows[0].ts;
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S %Z", localtime(&t));
+    fprintf(f, "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\">"
+        "<title>hstress latency, %s</title></head>\n<body>\n", when);
+    fprintf(f, "<p style=\"font-family: sans-serif\">hstress run from %s. "
+        "Darker cells had more responses; hover over one for its count.</p>\n", when);
+    writesvg(f);
+    fprintf(f, "</body></html>\n");
+}
+
+/* write out everything kept */
+void
+heatdone()
+{
+    int i, b;
+
+    if(nouts == 0)
+        return;
+
+    lo = Nheat;
+    hi = -1;
+    most = 0;
+    for(i=0; i<nrows; i++)
+        for(b=0; b<Nheat; b++){
+            if(rows[i].n[b] == 0)
+                continue;
+            lo = b < lo ? b : lo;
+            hi = b > hi ? b : hi;
+            most = rows[i].n[b] > most ? rows[i].n[b] : most;
+        }
+    if(hi < 0)
+        lo = hi = 0;
+
+    for(i=0; i<nouts; i++){
+        switch(outs[i].kind){
+        case Tsv:
+            writetsv(outs[i].f);
+            break;
+        case Svg:
+            if(nrows > 0)
+                writesvg(outs[i].f);
+            break;
+        case Html:
+            if(nrows > 0)
+                writehtml(outs[i].f);
+            break;
+        }
+        fclose(outs[i].f);
+    }
+    nouts = 0;
+}
@@ -0,0 +1,222 @@
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "u.h"
+#include "hist.h"
+
+static int
+histidx(uint64_t v)
+{
+	int m, k;
+
+	if(v >= 1ULL<<Hmaxbits)
+		v = (1ULL<<Hmaxbits) - 1;
+	if(v < 1<<Hsubbits)
+		return v;
+
+	m = 63 - __builtin_clzll(v);
+	k = m - Hsubbits + 1;
+	return k*Hhalf + (v >> k);
+}
+
+/* lowest and highest value that fall into bin i */
+static uint64_t
+histlo(int i)
+{
+	int k;
+
+	if(i < 1<<Hsubbits)
+		return i;
+	k = i/Hhalf - 1;
+	return (uint64_t)(i - k*Hhalf) << k;
+}
+
+static uint64_t
+histhi(int i)
+{
+	if(i < 1<<Hsubbits)
+		return i;
+	return histlo(i+1) - 1;
+}
+
+void
+histreset(Hist *h)
+{
+	memset(h, 0, sizeof(*h));
+}
+
+/*
+	A histogram has a single writer, but histsnap may read it from
+	another thread or process meanwhile. Relaxed atomic stores and
+	loads keep each count tear-free and cost nothing extra.
+*/
+void
+histrecord(Hist *h, uint64_t v)
+{
+	int i;
+
+	i = histidx(v);
+	__atomic_store_n(&h->n[i], h->n[i]+1, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->total, h->total+1, __ATOMIC_RELAXED);
+}
+
+void
+histsnap(Hist *dst, Hist *src)
+{
+	int i;
+
+	dst->total = __atomic_load_n(&src->total, __ATOMIC_RELAXED);
+	for(i=0; i<Nhist; i++)
+		dst->n[i] = __atomic_load_n(&src->n[i], __ATOMIC_RELAXED);
+}
+
+/*
+	Adds what cur holds beyond an earlier snapshot, last, into dst.
+	A snapshot's total can lag its bins, so the total is rebuilt
+	from the bins.
+*/
+void
+histdelta(Hist *dst, Hist *cur, Hist *last)
+{
+	uint64_t d;
+	int i;
+
+	for(i=0; i<Nhist; i++){
+		d = cur->n[i] - last->n[i];
+		dst->n[i] += d;
+		dst->total += d;
+	}
+}
+
+void
+histmerge(Hist *dst, Hist *src)
+{
+	int i;
+
+	if(src->total == 0)
+		return;
+	for(i=0; i<Nhist; i++)
+		dst->n[i] += src->n[i];
+	dst->total += src->total;
+}
+
+/*
+	The value at or below which pct percent of the recorded
+	values fall, reported as the top of its bin as HDR does.
+*/
+uint64_t
+histpct(Hist *h, double pct)
+{
+	uint64_t want, seen;
+	int i;
+
+	if(h->total == 0)
+		return 0;
+
+	want = (uint64_t)(pct/100.0*h->total + 0.5);
+	if(want < 1)
+		want = 1;
+
+	seen = 0;
+	for(i=0; i<Nhist; i++){
+		seen += h->n[i];
+		if(seen >= want)
+			return histhi(i);
+	}
+	return histhi(Nhist-1);
+}
+
+/* the middle of bin i, for those that want one value for it */
+double
+histmid(int i)
+{
+	return (histlo(i) + histhi(i)) / 2.0;
+}
+
+uint64_t
+histmax(Hist *h)
+{
+	int i;
+
+	for(i=Nhist-1; i>=0; i--)
+		if(h->n[i] != 0)
+			return histhi(i);
+	return 0;
+}
+
+double
+histmean(Hist *h)
+{
+	double sum;
+	int i;
+
+	if(h->total == 0)
+		return 0;
+
+	sum = 0;
+	for(i=0; i<Nhist; i++)
+		if(h->n[i] != 0)
+			sum += h->n[i] * histmid(i);
+	return sum / h->total;
+}
+
+/*
+	Sparse text encoding, "bin:count,bin:count,...", or "-" for
+	an empty histogram. It contains no tabs or newlines, so it
+	can travel as a single field of a TSV line.
+*/
+char *
+histenc(Hist *h, char *buf, size_t n)
+{
+	size_t off;
+	int i, w;
+
+	if(n < 2)
+		panic("histenc: buffer too small");
+
+	strcpy(buf, "-");
+	off = 0;
+	for(i=0; i<Nhist; i++){
+		if(h->n[i] == 0)
+			continue;
+		w = snprintf(buf+off, n-off, "%s%d:%llu",
+		    off == 0 ? "" : ",", i, (unsigned long long)h->n[i]);
+		if(w < 0 || w >= n-off)
+			panic("histenc: buffer too small");
+		off += w;
+	}
+	return buf;
+}
+
+/* Adds an encoded histogram into h; returns -1 on malformed input. */
+int
+histdec(Hist *h, char *s)
+{
+	char *end;
+	long i;
+	unsigned long long c;
+
+	if(strcmp(s, "-") == 0)
+		return 0;
+
+	while(*s != '\0'){
+		i = strtol(s, &end, 10);
+		if(end == s || *end != ':' || i < 0 || i >= Nhist)
+			return -1;
+		s = end + 1;
+		c = strtoull(s, &end, 10);
+		if(end == s)
+			return -1;
+		h->n[i] += c;
+		h->total += c;
+		s = end;
+		if(*s == ',')
+			s++;
+		else if(*s != '\0')
+			return -1;
+	}
+	return 0;
+}
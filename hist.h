@@ -0,0 +1,34 @@
+/*
+	Log-linear (HDR-style) latency histograms.
+
+	Values are microseconds. Values below 1<<Hsubbits are counted
+	exactly; above that each power of two is split into Hhalf
+	equal bins, so a bin is never wider than 1/Hhalf of its value.
+	Recording is O(1) and histograms merge losslessly by adding
+	bins.
+*/
+
+enum{
+	Hsubbits = 7,
+	Hhalf = 1<<(Hsubbits-1),
+	Hmaxbits = 36,	/* values saturate at ~19 hours */
+	Nhist = (Hmaxbits-Hsubbits+2)*Hhalf,
+};
+
+struct Hist{
+	uint64_t total;
+	uint64_t n[Nhist];
+};
+typedef struct Hist Hist;
+
+void histreset(Hist *h);
+void histrecord(Hist *h, uint64_t v);
+void histmerge(Hist *dst, Hist *src);
+void histsnap(Hist *dst, Hist *src);
+void histdelta(Hist *dst, Hist *cur, Hist *last);
+uint64_t histpct(Hist *h, double pct);
+uint64_t histmax(Hist *h);
+double histmid(int i);
+double histmean(Hist *h);
+char *histenc(Hist *h, char *buf, size_t n);
+int histdec(Hist *h, char *s);
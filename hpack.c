@@ -0,0 +1,511 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "u.h"
+#include "hpack.h"
+
+/* what the dynamic table may hold; we never offer the peer more */
+enum{
+	Tabmax = 4096,
+	Tabslots = Tabmax/32,
+};
+
+struct Hfield{
+	char	*name;
+	char	*value;
+	int	nlen;
+	int	vlen;
+};
+
+static struct{
+	char	*name;
+	char	*value;
+} stab[] = {
+	{ ":authority", "" },
+	{ ":method", "GET" },
+	{ ":method", "POST" },
+	{ ":path", "/" },
+	{ ":path", "/index.html" },
+	{ ":scheme", "http" },
+	{ ":scheme", "https" },
+	{ ":status", "200" },
+	{ ":status", "204" },
+	{ ":status", "206" },
+	{ ":status", "304" },
+	{ ":status", "400" },
+	{ ":status", "404" },
+	{ ":status", "500" },
+	{ "accept-charset", "" },
+	{ "accept-encoding", "gzip, deflate" },
+	{ "accept-language", "" },
+	{ "accept-ranges", "" },
+	{ "accept", "" },
+	{ "access-control-allow-origin", "" },
+	{ "age", "" },
+	{ "allow", "" },
+	{ "authorization", "" },
+	{ "cache-control", "" },
+	{ "content-disposition", "" },
+	{ "content-encoding", "" },
+	{ "content-language", "" },
+	{ "content-length", "" },
+	{ "content-location", "" },
+	{ "content-range", "" },
+	{ "content-type", "" },
+	{ "cookie", "" },
+	{ "date", "" },
+	{ "etag", "" },
+	{ "expect", "" },
+	{ "expires", "" },
+	{ "from", "" },
+	{ "host", "" },
+	{ "if-match", "" },
+	{ "if-modified-since", "" },
+	{ "if-none-match", "" },
+	{ "if-range", "" },
+	{ "if-unmodified-since", "" },
+	{ "last-modified", "" },
+	{ "link", "" },
+	{ "location", "" },
+	{ "max-forwards", "" },
+	{ "proxy-authenticate", "" },
+	{ "proxy-authorization", "" },
+	{ "range", "" },
+	{ "referer", "" },
+	{ "refresh", "" },
+	{ "retry-after", "" },
+	{ "server", "" },
+	{ "set-cookie", "" },
+	{ "strict-transport-security", "" },
+	{ "transfer-encoding", "" },
+	{ "user-agent", "" },
+	{ "vary", "" },
+	{ "via", "" },
+	{ "www-authenticate", "" },
+};
+#define NSTAB (sizeof(stab)/sizeof(stab[0]))
+
+/* the Huffman code, by symbol; 256 is end of string */
+static struct{
+	uint32_t	code;
+	int		len;
+} huff[257] = {
+	{ 0x1ff8, 13 }, { 0x007fffd8, 23 }, { 0x0fffffe2, 28 }, { 0x0fffffe3, 28 },
+	{ 0x0fffffe4, 28 }, { 0x0fffffe5, 28 }, { 0x0fffffe6, 28 }, { 0x0fffffe7, 28 },
+	{ 0x0fffffe8, 28 }, { 0x00ffffea, 24 }, { 0x3ffffffc, 30 }, { 0x0fffffe9, 28 },
+	{ 0x0fffffea, 28 }, { 0x3ffffffd, 30 }, { 0x0fffffeb, 28 }, { 0x0fffffec, 28 },
+	{ 0x0fffffed, 28 }, { 0x0fffffee, 28 }, { 0x0fffffef, 28 }, { 0x0ffffff0, 28 },
+	{ 0x0ffffff1, 28 }, { 0x0ffffff2, 28 }, { 0x3ffffffe, 30 }, { 0x0ffffff3, 28 },
+	{ 0x0ffffff4, 28 }, { 0x0ffffff5, 28 }, { 0x0ffffff6, 28 }, { 0x0ffffff7, 28 },
+	{ 0x0ffffff8, 28 }, { 0x0ffffff9, 28 }, { 0x0ffffffa, 28 }, { 0x0ffffffb, 28 },
+	{ 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 },
+	{ 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 },
+	{ 0x3fa, 10 }, { 0x3fb, 10 }, { 0xf9, 8 }, { 0x7fb, 11 },
+	{ 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+	{ 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 },
+	{ 0x1a, 6 }, { 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 },
+	{ 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 },
+	{ 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 },
+	{ 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 },
+	{ 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+	{ 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 },
+	{ 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 },
+	{ 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 },
+	{ 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 },
+	{ 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 },
+	{ 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+	{ 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 },
+	{ 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 }, { 0x26, 6 },
+	{ 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 },
+	{ 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 },
+	{ 0x2b, 6 }, { 0x76, 7 }, { 0x2c, 6 }, { 0x8, 5 },
+	{ 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+	{ 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 },
+	{ 0x7fc, 11 }, { 0x3ffd, 14 }, { 0x1ffd, 13 }, { 0x0ffffffc, 28 },
+	{ 0xfffe6, 20 }, { 0x003fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 },
+	{ 0x003fffd3, 22 }, { 0x003fffd4, 22 }, { 0x003fffd5, 22 }, { 0x007fffd9, 23 },
+	{ 0x003fffd6, 22 }, { 0x007fffda, 23 }, { 0x007fffdb, 23 }, { 0x007fffdc, 23 },
+	{ 0x007fffdd, 23 }, { 0x007fffde, 23 }, { 0x00ffffeb, 24 }, { 0x007fffdf, 23 },
+	{ 0x00ffffec, 24 }, { 0x00ffffed, 24 }, { 0x003fffd7, 22 }, { 0x007fffe0, 23 },
+	{ 0x00ffffee, 24 }, { 0x007fffe1, 23 }, { 0x007fffe2, 23 }, { 0x007fffe3, 23 },
+	{ 0x007fffe4, 23 }, { 0x001fffdc, 21 }, { 0x003fffd8, 22 }, { 0x007fffe5, 23 },
+	{ 0x003fffd9, 22 }, { 0x007fffe6, 23 }, { 0x007fffe7, 23 }, { 0x00ffffef, 24 },
+	{ 0x003fffda, 22 }, { 0x001fffdd, 21 }, { 0xfffe9, 20 }, { 0x003fffdb, 22 },
+	{ 0x003fffdc, 22 }, { 0x007fffe8, 23 }, { 0x007fffe9, 23 }, { 0x001fffde, 21 },
+	{ 0x007fffea, 23 }, { 0x003fffdd, 22 }, { 0x003fffde, 22 }, { 0x00fffff0, 24 },
+	{ 0x001fffdf, 21 }, { 0x003fffdf, 22 }, { 0x007fffeb, 23 }, { 0x007fffec, 23 },
+	{ 0x001fffe0, 21 }, { 0x001fffe1, 21 }, { 0x003fffe0, 22 }, { 0x001fffe2, 21 },
+	{ 0x007fffed, 23 }, { 0x003fffe1, 22 }, { 0x007fffee, 23 }, { 0x007fffef, 23 },
+	{ 0xfffea, 20 }, { 0x003fffe2, 22 }, { 0x003fffe3, 22 }, { 0x003fffe4, 22 },
+	{ 0x007ffff0, 23 }, { 0x003fffe5, 22 }, { 0x003fffe6, 22 }, { 0x007ffff1, 23 },
+	{ 0x03ffffe0, 26 }, { 0x03ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 },
+	{ 0x003fffe7, 22 }, { 0x007ffff2, 23 }, { 0x003fffe8, 22 }, { 0x01ffffec, 25 },
+	{ 0x03ffffe2, 26 }, { 0x03ffffe3, 26 }, { 0x03ffffe4, 26 }, { 0x07ffffde, 27 },
+	{ 0x07ffffdf, 27 }, { 0x03ffffe5, 26 }, { 0x00fffff1, 24 }, { 0x01ffffed, 25 },
+	{ 0x7fff2, 19 }, { 0x001fffe3, 21 }, { 0x03ffffe6, 26 }, { 0x07ffffe0, 27 },
+	{ 0x07ffffe1, 27 }, { 0x03ffffe7, 26 }, { 0x07ffffe2, 27 }, { 0x00fffff2, 24 },
+	{ 0x001fffe4, 21 }, { 0x001fffe5, 21 }, { 0x03ffffe8, 26 }, { 0x03ffffe9, 26 },
+	{ 0x0ffffffd, 28 }, { 0x07ffffe3, 27 }, { 0x07ffffe4, 27 }, { 0x07ffffe5, 27 },
+	{ 0xfffec, 20 }, { 0x00fffff3, 24 }, { 0xfffed, 20 }, { 0x001fffe6, 21 },
+	{ 0x003fffe9, 22 }, { 0x001fffe7, 21 }, { 0x001fffe8, 21 }, { 0x007ffff3, 23 },
+	{ 0x003fffea, 22 }, { 0x003fffeb, 22 }, { 0x01ffffee, 25 }, { 0x01ffffef, 25 },
+	{ 0x00fffff4, 24 }, { 0x00fffff5, 24 }, { 0x03ffffea, 26 }, { 0x007ffff4, 23 },
+	{ 0x03ffffeb, 26 }, { 0x07ffffe6, 27 }, { 0x03ffffec, 26 }, { 0x03ffffed, 26 },
+	{ 0x07ffffe7, 27 }, { 0x07ffffe8, 27 }, { 0x07ffffe9, 27 }, { 0x07ffffea, 27 },
+	{ 0x07ffffeb, 27 }, { 0x0ffffffe, 28 }, { 0x07ffffec, 27 }, { 0x07ffffed, 27 },
+	{ 0x07ffffee, 27 }, { 0x07ffffef, 27 }, { 0x07fffff0, 27 }, { 0x03ffffee, 26 },
+	{ 0x3fffffff, 30 },
+};
+
+/*
+	The code as a binary tree, for decoding a bit at a time: each
+	node's children are another node, or a leaf holding -(symbol+1).
+	0 is the root, and so never a child.
+*/
+static short tree[256][2];
+static pthread_once_t treeonce = PTHREAD_ONCE_INIT;
+
+static void
+mktree(void)
+{
+	int sym, b, bit, node, nnodes;
+
+	nnodes = 1;
+	for(sym=0; sym<257; sym++){
+		node = 0;
+		for(b=huff[sym].len-1; b>0; b--){
+			bit = huff[sym].code >> b & 1;
+			if(tree[node][bit] == 0)
+				tree[node][bit] = nnodes++;
+			node = tree[node][bit];
+		}
+		tree[node][huff[sym].code & 1] = -(sym+1);
+	}
+}
+
+/* the n bytes at p, decoded into out; -1 if they are not a string */
+static int
+huffdec(unsigned char *p, int n, char *out)
+{
+	int i, b, k, node, depth;
+
+	k = 0;
+	node = depth = 0;
+	for(i=0; i<n; i++)
+		for(b=7; b>=0; b--){
+			node = tree[node][p[i] >> b & 1];
+			depth++;
+			if(node == 0)
+				return -1;
+			if(node < 0){
+				if(node == -257)
+					return -1;
+				out[k++] = -node - 1;
+				node = depth = 0;
+			}
+		}
+	// what is left over is padding, the start of the end of string
+	if(depth > 7)
+		return -1;
+	return k;
+}
+
+void
+h2put(unsigned char *p, int len, int type, int flags, uint32_t id)
+{
+	p[0] = len >> 16;
+	p[1] = len >> 8;
+	p[2] = len;
+	p[3] = type;
+	p[4] = flags;
+	h2put32(p+5, id);
+}
+
+void
+h2get(unsigned char *p, H2frame *f)
+{
+	f->len = p[0] << 16 | p[1] << 8 | p[2];
+	f->type = p[3];
+	f->flags = p[4];
+	f->id = h2u32(p+5) & 0x7fffffff;
+}
+
+uint32_t
+h2u32(unsigned char *p)
+{
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+void
+h2put32(unsigned char *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/* a setting, as it goes in a SETTINGS frame */
+int
+h2setting(unsigned char *p, int id, uint32_t v)
+{
+	p[0] = id >> 8;
+	p[1] = id;
+	h2put32(p+2, v);
+	return 6;
+}
+
+void
+hpackinit(Hpack *h)
+{
+	pthread_once(&treeonce, mktree);
+	memset(h, 0, sizeof(*h));
+	h->tab = mal(Tabslots * sizeof(struct Hfield));
+	h->max = Tabmax;
+}
+
+void
+hpackfree(Hpack *h)
+{
+	int i;
+
+	for(i=0; i<h->n; i++)
+		free(h->tab[(h->head + i) % Tabslots].name);
+	free(h->tab);
+	free(h->buf);
+	memset(h, 0, sizeof(*h));
+}
+
+/* drop the oldest entries until room more bytes fit */
+static void
+evict(Hpack *h, int room)
+{
+	struct Hfield *f;
+
+	while(h->n > 0 && h->size + room > h->max){
+		f = &h->tab[(h->head + h->n - 1) % Tabslots];
+		h->size -= f->nlen + f->vlen + 32;
+		free(f->name);
+		h->n--;
+	}
+}
+
+static void
+insert(Hpack *h, char *name, int nlen, char *value, int vlen)
+{
+	struct Hfield *f;
+	char *s;
+	int size;
+
+	// the name may be an entry's that is about to go
+	size = nlen + vlen + 32;
+	s = mal(nlen + vlen + 1);
+	memcpy(s, name, nlen);
+	memcpy(s + nlen, value, vlen);
+	evict(h, size);
+	if(size > h->max){
+		free(s);
+		return;
+	}
+	h->head = (h->head + Tabslots - 1) % Tabslots;
+	f = &h->tab[h->head];
+	f->name = s;
+	f->nlen = nlen;
+	f->value = s + nlen;
+	f->vlen = vlen;
+	h->n++;
+	h->size += size;
+}
+
+/* the field at index i of the static and dynamic tables */
+static int
+lookup(Hpack *h, uint64_t i, char **name, int *nlen, char **value, int *vlen)
+{
+	struct Hfield *f;
+
+	if(i == 0)
+		return -1;
+	if(i <= NSTAB){
+		*name = stab[i-1].name;
+		*nlen = strlen(*name);
+		*value = stab[i-1].value;
+		*vlen = strlen(*value);
+		return 0;
+	}
+	i -= NSTAB + 1;
+	if(i >= h->n)
+		return -1;
+	f = &h->tab[(h->head + i) % Tabslots];
+	*name = f->name;
+	*nlen = f->nlen;
+	*value = f->value;
+	*vlen = f->vlen;
+	return 0;
+}
+
+/* an integer with a bits-bit prefix */
+static int
+getint(unsigned char **pp, unsigned char *e, int bits, uint64_t *v)
+{
+	unsigned char *p = *pp;
+	uint64_t m;
+	int shift;
+
+	if(p >= e)
+		return -1;
+	m = (1 << bits) - 1;
+	*v = *p++ & m;
+	if(*v == m)
+		for(shift=0;; shift+=7){
+			if(p >= e || shift > 28)
+				return -1;
+			*v += (uint64_t)(*p & 0x7f) << shift;
+			if(!(*p++ & 0x80))
+				break;
+		}
+	*pp = p;
+	return 0;
+}
+
+/* a string literal, decoded to h->buf + *off */
+static int
+getstr(Hpack *h, unsigned char **pp, unsigned char *e, int *off, int *len)
+{
+	unsigned char *p = *pp;
+	uint64_t n;
+	int huffman;
+
+	if(p >= e)
+		return -1;
+	huffman = *p & 0x80;
+	if(getint(&p, e, 7, &n) < 0 || n > e - p)
+		return -1;
+	if(huffman){
+		if((*len = huffdec(p, n, h->buf + *off)) < 0)
+			return -1;
+	}else{
+		memcpy(h->buf + *off, p, n);
+		*len = n;
+	}
+	*pp = p + n;
+	return 0;
+}
+
+/*
+	Decode the header block of n bytes at p, calling f for each
+	field in turn. Returns -1 if it is bad, after which h is no
+	more use: the peer and we no longer agree on its table.
+*/
+int
+hpackdec(Hpack *h, unsigned char *p, int n, Hfieldfn *f, void *arg)
+{
+	unsigned char *e;
+	uint64_t i;
+	char *name, *value;
+	int nlen, vlen, noff, voff, inc;
+
+	// nothing decodes to more than 8/5 of itself
+	if(h->bufsz < 2*n){
+		h->bufsz = 2*n;
+		free(h->buf);
+		h->buf = mal(h->bufsz);
+	}
+
+	for(e=p+n; p<e;){
+		if(*p & 0x80){
+			// indexed
+			if(getint(&p, e, 7, &i) < 0 || lookup(h, i, &name, &nlen, &value, &vlen) < 0)
+				return -1;
+			f(arg, name, nlen, value, vlen);
+		}else if((*p & 0xe0) == 0x20){
+			// table size update
+			if(getint(&p, e, 5, &i) < 0 || i > Tabmax)
+				return -1;
+			h->max = i;
+			evict(h, 0);
+		}else{
+			// literal, with an indexed or literal name
+			inc = (*p & 0xc0) == 0x40;
+			if(getint(&p, e, inc ? 6 : 4, &i) < 0)
+				return -1;
+			noff = -1;
+			voff = 0;
+			if(i != 0){
+				if(lookup(h, i, &name, &nlen, &value, &vlen) < 0)
+					return -1;
+			}else{
+				noff = 0;
+				if(getstr(h, &p, e, &noff, &nlen) < 0)
+					return -1;
+				voff = nlen;
+			}
+			if(getstr(h, &p, e, &voff, &vlen) < 0)
+				return -1;
+			if(noff >= 0)
+				name = h->buf + noff;
+			value = h->buf + voff;
+			f(arg, name, nlen, value, vlen);
+			if(inc)
+				insert(h, name, nlen, value, vlen);
+		}
+	}
+	return 0;
+}
+
+static int
+putint(unsigned char *p, uint64_t v, int bits, int first)
+{
+	uint64_t m;
+	int n;
+
+	m = (1 << bits) - 1;
+	if(v < m){
+		p[0] = first | v;
+		return 1;
+	}
+	p[0] = first | m;
+	v -= m;
+	for(n=1; v>=128; v/=128)
+		p[n++] = v%128 | 0x80;
+	p[n++] = v;
+	return n;
+}
+
+static int
+putstr(unsigned char *p, char *s)
+{
+	int n, len;
+
+	len = strlen(s);
+	n = putint(p, len, 7, 0);
+	memcpy(p + n, s, len);
+	return n + len;
+}
+
+/*
+	Encode a field at p, which has room for its name and value and
+	a dozen bytes more: from the static table if it is there whole,
+	otherwise as a literal, with the name from the table if it can.
+	Returns its length.
+*/
+int
+hpackfield(unsigned char *p, char *name, char *value)
+{
+	int i, idx, n;
+
+	idx = 0;
+	for(i=0; i<NSTAB; i++)
+		if(strcmp(stab[i].name, name) == 0){
+			if(strcmp(stab[i].value, value) == 0)
+				return putint(p, i+1, 7, 0x80);
+			if(idx == 0)
+				idx = i+1;
+		}
+	n = putint(p, idx, 4, 0);
+	if(idx == 0)
+		n += putstr(p + n, name);
+	return n + putstr(p + n, value);
+}
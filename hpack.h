@@ -0,0 +1,87 @@
+/*
+	HTTP/2 framing (RFC 7540) and header compression (RFC 7541),
+	as much of them as hstress and hserve need.
+
+	The decoder is complete: indexing, the dynamic table and
+	Huffman coding. The encoder only ever writes literals that are
+	not indexed, so it keeps no state, and a header block can be
+	made once and sent on any number of connections.
+
+	Callers include <stdint.h> first.
+*/
+
+#define H2PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+
+/* frame types */
+enum{
+	H2data,
+	H2headers,
+	H2priority,
+	H2rst,
+	H2settings,
+	H2push,
+	H2ping,
+	H2goaway,
+	H2window,
+	H2continuation,
+};
+
+/* frame flags */
+enum{
+	H2endstream = 0x1,
+	H2ack = 0x1,
+	H2endheaders = 0x4,
+	H2padded = 0x8,
+	H2priorityflag = 0x20,
+};
+
+/* settings */
+enum{
+	H2tablesize = 1,
+	H2enablepush,
+	H2maxstreams,
+	H2initwindow,
+	H2maxframe,
+	H2maxheaders,
+};
+
+enum{
+	H2hdrlen = 9,                   /* a frame's header */
+	H2minframe = 16384,             /* the largest frame until SETTINGS says more */
+	H2defwindow = 65535,
+	H2maxwindow = 0x7fffffff,
+	H2cancel = 0x8,                 /* RST_STREAM error code */
+};
+
+typedef struct H2frame H2frame;
+struct H2frame{
+	int		len;
+	int		type;
+	int		flags;
+	uint32_t	id;
+};
+
+typedef struct Hpack Hpack;
+struct Hpack{
+	struct Hfield	*tab;		/* the dynamic table, in a ring, newest at head */
+	int		head;
+	int		n;
+	int		size;
+	int		max;
+	char		*buf;		/* decoded strings */
+	int		bufsz;
+};
+
+/* a decoded field; name and value are not NUL-terminated */
+typedef void Hfieldfn(void *arg, char *name, int nlen, char *value, int vlen);
+
+void h2put(unsigned char *p, int len, int type, int flags, uint32_t id);
+void h2get(unsigned char *p, H2frame *f);
+uint32_t h2u32(unsigned char *p);
+void h2put32(unsigned char *p, uint32_t v);
+int h2setting(unsigned char *p, int id, uint32_t v);
+
+void hpackinit(Hpack *h);
+void hpackfree(Hpack *h);
+int hpackdec(Hpack *h, unsigned char *p, int n, Hfieldfn *f, void *arg);
+int hpackfield(unsigned char *p, char *name, char *value);
@@ -1,6 +1,9 @@
 /*
 	Play HTTP requests from a stdin. Note that HTTP parsing is
 	fairly robust to accomodate for packet dumps, etc.
+
+	A host with a slash in it is the path of a Unix domain socket,
+	and the port is ignored.
 */
 
 #include <event.h>
@@ -8,8 +11,11 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <event.h>
 #include <evhttp.h>
+#include <event2/bufferevent.h>
 
 #include "u.h"
 
@@ -23,6 +29,7 @@ typedef struct Header Header;
 enum{
 	Nfbuf = 1<<20,
 	Nq = 100,
+	Ntimeout = 10,	/* seconds, for a request over a Unix socket */
 };
 
 struct Request{
@@ -32,6 +39,7 @@ struct Request{
 	Header headers[10];
 	int nheader;
 	int nbody;
+	char *body;
 };
 typedef struct Request Request;
 
@@ -43,6 +51,8 @@ struct Run{
 	char *host;
 	short port;
 	struct evhttp_connection *cachedconn;
+	struct event_base *base;
+	struct sockaddr_un *sun;	/* if host is a path */
 };
 typedef struct Run Run;
 
@@ -119,6 +129,17 @@ peekline()
 	return rv;
 }
 
+/* n bytes straight after the last line read */
+int
+readn(char *buf, int n)
+{
+	int m;
+
+	m = fread(buf, 1, n, io.file);
+	io.nread += m;
+	return m;
+}
+
 int
 eof()
 {
@@ -150,6 +171,7 @@ zerorequest(Request *r)
 	}
 
 	r->nheader = r->nbody = 0;
+	r->body = nil;
 }
 
 int
@@ -242,6 +264,7 @@ int
 readrequest(Request *r)
 {
 	int i, clen, nhdr;
+	char *line;
 	
 	clen = 0;
 
@@ -258,6 +281,21 @@ readrequest(Request *r)
 	}
 	r->nheader = i;
 
+	/* the blank line, then as much body as Content-Length says */
+	if(r->nbody > 0){
+		line = peekline();
+		if(line == nil || *line != '\0')
+			return 0;
+		readline();
+		r->body = mal(r->nbody);
+		if(readn(r->body, r->nbody) != r->nbody){
+			free(r->body);
+			r->body = nil;
+			return 0;
+		}
+	}else
+		r->nbody = 0;
+
 /*
 	for(i=0; i<2; i++){
 		line = readline();
@@ -310,6 +348,72 @@ donecb(struct evhttp_request *req, void *arg)
 		evhttp_connection_free(call->conn);
 }
 
+/*
+	libevent's HTTP client cannot connect to a Unix domain socket,
+	so over one each request is written by hand, on a connection
+	of its own that the server closes once it has answered.
+*/
+
+void
+unixreadcb(struct bufferevent *bev, void *arg)
+{
+	struct evbuffer *in;
+
+	in = bufferevent_get_input(bev);
+	evbuffer_drain(in, evbuffer_get_length(in));
+}
+
+void
+unixeventcb(struct bufferevent *bev, short what, void *arg)
+{
+	if(what & (BEV_EVENT_EOF|BEV_EVENT_ERROR|BEV_EVENT_TIMEOUT))
+		bufferevent_free(bev);
+}
+
+void
+unixrequest(Run *run, Request *r)
+{
+	struct bufferevent *bev;
+	struct evbuffer *out;
+	struct timeval tv;
+	Header *h;
+	int i, hashost, haslen;
+
+	bev = bufferevent_socket_new(run->base, -1, BEV_OPT_CLOSE_ON_FREE);
+	if(bev == nil)
+		panic("bufferevent_socket_new");
+	bufferevent_setcb(bev, unixreadcb, nil, unixeventcb, nil);
+	tv.tv_sec = Ntimeout;
+	tv.tv_usec = 0;
+	bufferevent_set_timeouts(bev, &tv, &tv);
+	bufferevent_enable(bev, EV_READ);
+	if(bufferevent_socket_connect(bev, (struct sockaddr*)run->sun, sizeof(*run->sun)) < 0){
+		bufferevent_free(bev);
+		return;
+	}
+
+	out = bufferevent_get_output(bev);
+	evbuffer_add_printf(out, "%s %s HTTP/1.1\r\n", r->action, r->uri);
+	hashost = haslen = 0;
+	for(i=0;i<r->nheader;i++){
+		h = &r->headers[i];
+		if(strcasecmp(h->key, "connection") == 0)
+			continue;
+		if(strcasecmp(h->key, "host") == 0)
+			hashost = 1;
+		if(strcasecmp(h->key, "content-length") == 0)
+			haslen = 1;
+		evbuffer_add_printf(out, "%s: %s\r\n", h->key, h->value);
+	}
+	if(!hashost)
+		evbuffer_add_printf(out, "Host: localhost\r\n");
+	if(!haslen && strcasecmp(r->action, "post") == 0)
+		evbuffer_add_printf(out, "Content-Length: 0\r\n");
+	evbuffer_add_printf(out, "Connection: close\r\n\r\n");
+	if(r->body != nil)
+		evbuffer_add(out, r->body, r->nbody);
+}
+
 void
 runcb(int fd, short what, void *arg)
 {
@@ -325,6 +429,19 @@ runcb(int fd, short what, void *arg)
 	run = (Run*)arg;
 	r = &run->rs[rand() % run->rsiz];
 
+	if(strcasecmp(r->action, "get")==0)
+		cmd = EVHTTP_REQ_GET;
+	else if(strcasecmp(r->action, "post")==0)
+		cmd = EVHTTP_REQ_POST;
+	else
+		panic("invalid action \"%s\"", r->action);
+
+	if(run->sun != nil){
+		unixrequest(run, r);
+		event_add(&run->ev, &run->tv);
+		return;
+	}
+
 	if(run->cachedconn!=nil){
 		conn = run->cachedconn;
 		run->cachedconn = nil;
@@ -337,19 +454,14 @@ runcb(int fd, short what, void *arg)
 
 	req = evhttp_request_new(&donecb, c);
 
-	if(strcasecmp(r->action, "get")==0)
-		cmd = EVHTTP_REQ_GET;
-	else if(strcasecmp(r->action, "post")==0)
-		cmd = EVHTTP_REQ_POST;
-	else
-		panic("invalid action \"%s\"", r->action);
-
 	for(i=0;i<r->nheader;i++){
 		h = &r->headers[i];
 		evhttp_add_header(
 		    req->output_headers,
 		    h->key, h->value);
 	}
+	if(r->body != nil)
+		evbuffer_add(req->output_buffer, r->body, r->nbody);
 
 	evhttp_make_request(conn, req, cmd, r->uri);
 
@@ -367,10 +479,10 @@ main(int argc, char **argv)
 	FILE **fs, *f;
 
 	if(argc < 4)
-		panic("usage: %s host port qps [file ...]", argv[0]);
+		panic("usage: %s host|path port qps [file ...]", argv[0]);
 	host = argv[1];
 	port = atoi(argv[2]);
-	if(port == 0)
+	if(port == 0 && strchr(host, '/') == nil)
 		panic("invalid port \"%s\"", argv[2]);
 	qps = atoi(argv[3]);
 	if(qps==0)
@@ -387,7 +499,7 @@ main(int argc, char **argv)
 		for(i=0;i<argc-4;i++){
 			fs[i] = fopen(argv[i+4], "r");
 			if(fs[i] == nil)
-				panic("failed to open \"%s\"", argv[i+3]);
+				panic("failed to open \"%s\"", argv[i+4]);
 		}
 		fs[i] = nil;
 	}else{
@@ -396,6 +508,7 @@ main(int argc, char **argv)
 		fs[1] = nil;
 	}
 
+	i = 0;
 	while((f=*(fs++)) != nil){
 		setfile(f);
 		while(!eof()){
@@ -412,7 +525,7 @@ main(int argc, char **argv)
 
 	say("parsed %d requests, failed %d", i, fail);
 
-	event_init();
+	run.base = event_init();
 	
 	run.rs = rs;
 	run.rsiz = i;
@@ -421,6 +534,15 @@ main(int argc, char **argv)
 	run.host = host;
 	run.port = port;
 	run.cachedconn = nil;
+	run.sun = nil;
+	if(strchr(host, '/') != nil){
+		run.sun = mal(sizeof(*run.sun));
+		memset(run.sun, 0, sizeof(*run.sun));
+		run.sun->sun_family = AF_UNIX;
+		if(strlen(host) >= sizeof(run.sun->sun_path))
+			panic("socket path too long: %s", host);
+		strcpy(run.sun->sun_path, host);
+	}
 
 	evtimer_set(&run.ev, runcb, &run);
 	evtimer_add(&run.ev, &run.tv);
@@ -3,40 +3,413 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 #include <signal.h>
 #include <assert.h>
 #include <errno.h>
+#include <stdint.h>
 #include <event.h>
 #include <evhttp.h>
+#include <event2/bufferevent_ssl.h>
+#include <event2/listener.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
 
 #include "u.h"
+#include "hpack.h"
 
 static void respond(struct evhttp_request *req, void *arg);
 char content[6*1024];
 
+/* with a certificate and key, HTTPS; sessions can be resumed by ticket or from the cache */
+SSL_CTX *ctx;
+
+static struct bufferevent *
+tlsbev(struct event_base *base, void *arg)
+{
+	return bufferevent_openssl_socket_new(base, -1, SSL_new(ctx),
+		BUFFEREVENT_SSL_ACCEPTING, BEV_OPT_CLOSE_ON_FREE);
+}
+
 void
-serve(char *host, short port)
+tlsinit(char *cert, char *key)
+{
+	if((ctx = SSL_CTX_new(TLS_server_method())) == nil)
+		panic("SSL_CTX_new");
+	if(SSL_CTX_use_certificate_chain_file(ctx, cert) != 1)
+		panic("%s: %s", cert, ERR_error_string(ERR_get_error(), nil));
+	if(SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) != 1)
+		panic("%s: %s", key, ERR_error_string(ERR_get_error(), nil));
+	SSL_CTX_set_session_id_context(ctx, (unsigned char *)"hserve", 6);
+}
+
+/* a listening Unix domain socket at path, in place of anything left there */
+int
+unixlisten(char *path)
+{
+	struct sockaddr_un sun;
+	int fd;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(sun.sun_path))
+		panic("socket path too long: %s", path);
+	strcpy(sun.sun_path, path);
+	unlink(path);
+	if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		panic("socket: %s", strerror(errno));
+	if(bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0 || listen(fd, 1024) < 0)
+		panic("failed to bind %s: %s", path, strerror(errno));
+	evutil_make_socket_nonblocking(fd);
+	return fd;
+}
+
+/* on a TCP port of host, or with a path, a Unix domain socket */
+void
+serve(char *host, short port, char *path)
 {
 	struct event_base *base;
 	struct evhttp *http;
+	struct evhttp_bound_socket *handle;
+	int one = 1;
 
 	assert(host != nil);
-	assert(port != 0);
+	assert(port != 0 || path != nil);
 
 	base = event_init();
 	if(base == nil) panic("malloc");
 	http = evhttp_new(base);
 	if(http == nil) panic("malloc");
 
-	if(evhttp_bind_socket(http, host, port) != 0)
-		panic("failed to bind port %d", port);
+	if(path != nil){
+		if(evhttp_accept_socket(http, unixlisten(path)) != 0)
+			panic("failed to listen on %s", path);
+		say("listening on %s%s", path, ctx != nil ? " (TLS)" : "");
+	}else{
+		if((handle = evhttp_bind_socket_with_handle(http, host, port)) == nil)
+			panic("failed to bind port %d", port);
 
-	say("listening on %s:%d", host, port);
+		/*
+			TLS writes a record for each piece of the response; without
+			this, Nagle holds the second until the client's delayed ACK.
+			Accepted sockets inherit it.
+		*/
+		setsockopt(evhttp_bound_socket_get_fd(handle), IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
 
+		say("listening on %s:%d%s", host, port, ctx != nil ? " (TLS)" : "");
+	}
+
+	if(ctx != nil)
+		evhttp_set_bevcb(http, tlsbev, nil);
 	evhttp_set_gencb(http, respond, nil);
 	event_base_dispatch(base);
 }
 
+/*
+	HTTP/2, with -2: cleartext, to clients that know to speak it.
+	Every request gets the same response as over HTTP/1.1 once it
+	has ended. Its headers are never decoded, so the client's header
+	table need not be kept, and its body is read only to give its
+	window back. Responses keep to the client's
+	windows, waiting on a list until there is room.
+*/
+
+struct h2pend{
+	uint32_t	id;
+	int		sent;		/* of content */
+	int64_t		window;		/* the client's, for this stream */
+};
+
+struct h2c{
+	struct bufferevent	*bev;
+	int			preface;	/* read it yet */
+	int64_t			window;		/* the client's, for the connection */
+	int64_t			initwindow;
+	int			maxframe;
+	uint32_t		hid;		/* a header block's stream, while more is to come */
+	int			hend;		/* and whether it ends the request */
+	struct h2pend		*pend;
+	int			npend;
+	int			pendsz;
+};
+
+/* the response headers, made once */
+static unsigned char h2head[64];
+static int h2headlen;
+
+static void
+h2frame(struct h2c *c, int type, int flags, uint32_t id, void *p, int n)
+{
+	unsigned char hdr[H2hdrlen];
+
+	h2put(hdr, n, type, flags, id);
+	bufferevent_write(c->bev, hdr, H2hdrlen);
+	if(n > 0)
+		bufferevent_write(c->bev, p, n);
+}
+
+static void
+h2window(struct h2c *c, uint32_t id, uint32_t v)
+{
+	unsigned char b[4];
+
+	h2put32(b, v);
+	h2frame(c, H2window, 0, id, b, 4);
+}
+
+/* send what the windows allow of the responses waiting */
+static void
+h2flush(struct h2c *c)
+{
+	struct h2pend *p;
+	int i, n;
+
+	for(i=0; i<c->npend; i++){
+		p = &c->pend[i];
+		while(p->sent < sizeof(content)){
+			n = sizeof(content) - p->sent;
+			n = n < c->maxframe ? n : c->maxframe;
+			n = n < c->window ? n : c->window;
+			n = n < p->window ? n : p->window;
+			if(n <= 0)
+				break;
+			h2frame(c, H2data, p->sent + n == sizeof(content) ? H2endstream : 0, p->id, content + p->sent, n);
+			p->sent += n;
+			c->window -= n;
+			p->window -= n;
+		}
+		if(p->sent == sizeof(content))
+			c->pend[i--] = c->pend[--c->npend];
+	}
+}
+
+static void
+h2respond(struct h2c *c, uint32_t id)
+{
+	struct h2pend *p;
+
+	h2frame(c, H2headers, H2endheaders, id, h2head, h2headlen);
+	if(c->npend == c->pendsz){
+		c->pendsz = c->pendsz ? 2*c->pendsz : 16;
+		c->pend = remal(c->pend, c->pendsz * sizeof(*c->pend));
+	}
+	p = &c->pend[c->npend++];
+	p->id = id;
+	p->sent = 0;
+	p->window = c->initwindow;
+	h2flush(c);
+}
+
+static struct h2pend *
+h2pending(struct h2c *c, uint32_t id)
+{
+	int i;
+
+	for(i=0; i<c->npend; i++)
+		if(c->pend[i].id == id)
+			return &c->pend[i];
+	return nil;
+}
+
+static void
+h2free(struct h2c *c)
+{
+	bufferevent_free(c->bev);
+	free(c->pend);
+	free(c);
+}
+
+/* act on a frame; -1 to hang up */
+static int
+h2input(struct h2c *c, H2frame *f, unsigned char *p)
+{
+	struct h2pend *pd;
+	int64_t delta;
+	uint32_t v;
+	int i;
+
+	if(c->hid != 0 && f->type != H2continuation)
+		return -1;
+
+	switch(f->type){
+	case H2headers:
+		if(!(f->flags & H2endheaders)){
+			c->hid = f->id;
+			c->hend = f->flags & H2endstream;
+		}else if(f->flags & H2endstream)
+			h2respond(c, f->id);
+		break;
+
+	case H2continuation:
+		if(f->id != c->hid)
+			return -1;
+		if(f->flags & H2endheaders){
+			if(c->hend)
+				h2respond(c, f->id);
+			c->hid = 0;
+		}
+		break;
+
+	case H2data:
+		// request bodies are dropped; give their window back
+		if(f->len > 0){
+			h2window(c, 0, f->len);
+			if(!(f->flags & H2endstream))
+				h2window(c, f->id, f->len);
+		}
+		if(f->flags & H2endstream)
+			h2respond(c, f->id);
+		break;
+
+	case H2rst:
+		if((pd = h2pending(c, f->id)) != nil)
+			*pd = c->pend[--c->npend];
+		break;
+
+	case H2settings:
+		if(f->flags & H2ack)
+			break;
+		if(f->len % 6 != 0)
+			return -1;
+		for(i=0; i<f->len; i+=6){
+			v = h2u32(p+i+2);
+			switch(p[i] << 8 | p[i+1]){
+			case H2initwindow:
+				delta = (int64_t)v - c->initwindow;
+				for(pd=c->pend; pd<c->pend+c->npend; pd++)
+					pd->window += delta;
+				c->initwindow = v;
+				break;
+			case H2maxframe:
+				c->maxframe = v;
+				break;
+			}
+		}
+		h2frame(c, H2settings, H2ack, 0, nil, 0);
+		h2flush(c);
+		break;
+
+	case H2ping:
+		if(f->len != 8)
+			return -1;
+		if(!(f->flags & H2ack))
+			h2frame(c, H2ping, H2ack, 0, p, 8);
+		break;
+
+	case H2window:
+		if(f->len != 4)
+			return -1;
+		v = h2u32(p) & 0x7fffffff;
+		if(f->id == 0)
+			c->window += v;
+		else if((pd = h2pending(c, f->id)) != nil)
+			pd->window += v;
+		h2flush(c);
+		break;
+
+	case H2goaway:
+		return -1;
+	}
+	return 0;
+}
+
+static void
+h2readcb(struct bufferevent *bev, void *arg)
+{
+	struct h2c *c = arg;
+	struct evbuffer *in = bufferevent_get_input(bev);
+	unsigned char hdr[H2hdrlen], *p;
+	H2frame f;
+
+	if(!c->preface){
+		if(evbuffer_get_length(in) < sizeof(H2PREFACE)-1)
+			return;
+		p = evbuffer_pullup(in, sizeof(H2PREFACE)-1);
+		if(memcmp(p, H2PREFACE, sizeof(H2PREFACE)-1) != 0){
+			h2free(c);
+			return;
+		}
+		evbuffer_drain(in, sizeof(H2PREFACE)-1);
+		c->preface = 1;
+	}
+
+	while(evbuffer_copyout(in, hdr, H2hdrlen) == H2hdrlen){
+		h2get(hdr, &f);
+		if(f.len > H2minframe){
+			h2free(c);
+			return;
+		}
+		if(evbuffer_get_length(in) < H2hdrlen + f.len)
+			return;
+		p = evbuffer_pullup(in, H2hdrlen + f.len);
+		if(h2input(c, &f, p + H2hdrlen) < 0){
+			h2free(c);
+			return;
+		}
+		evbuffer_drain(in, H2hdrlen + f.len);
+	}
+}
+
+static void
+h2eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	if(what & (BEV_EVENT_EOF | BEV_EVENT_ERROR))
+		h2free(arg);
+}
+
+static void
+h2accept(struct evconnlistener *l, evutil_socket_t fd, struct sockaddr *sa, int salen, void *arg)
+{
+	struct h2c *c;
+	int one = 1;
+
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if((c = calloc(1, sizeof(*c))) == nil)
+		panic("calloc");
+	c->window = c->initwindow = H2defwindow;
+	c->maxframe = H2minframe;
+	c->bev = bufferevent_socket_new(arg, fd, BEV_OPT_CLOSE_ON_FREE);
+	bufferevent_setcb(c->bev, h2readcb, nil, h2eventcb, c);
+	bufferevent_enable(c->bev, EV_READ | EV_WRITE);
+	h2frame(c, H2settings, 0, 0, nil, 0);
+}
+
+void
+serve2(char *host, short port, char *path)
+{
+	struct event_base *base;
+	struct evconnlistener *l;
+	struct sockaddr_in sin;
+	char len[16];
+
+	snprintf(len, sizeof(len), "%zu", sizeof(content));
+	h2headlen = hpackfield(h2head, ":status", "200");
+	h2headlen += hpackfield(h2head + h2headlen, "content-length", len);
+
+	if((base = event_base_new()) == nil)
+		panic("malloc");
+	if(path != nil){
+		if((l = evconnlistener_new(base, h2accept, base, LEV_OPT_CLOSE_ON_FREE, 0, unixlisten(path))) == nil)
+			panic("failed to listen on %s", path);
+		say("listening on %s (h2c)", path);
+	}else{
+		memset(&sin, 0, sizeof(sin));
+		sin.sin_family = AF_INET;
+		sin.sin_port = htons(port);
+		inet_pton(AF_INET, host, &sin.sin_addr);
+		l = evconnlistener_new_bind(base, h2accept, base, LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE, -1,
+			(struct sockaddr *)&sin, sizeof(sin));
+		if(l == nil)
+			panic("failed to bind port %d", port);
+		say("listening on %s:%d (h2c)", host, port);
+	}
+	event_base_dispatch(base);
+}
+
 void
 respond(struct evhttp_request *req, void *arg)
 {
@@ -50,22 +423,42 @@ respond(struct evhttp_request *req, void *arg)
 void
 usage(char *name)
 {
-	panic("Usage: %s <port>", name);
+	panic("Usage: %s [-2] <port>|<socket path> [<cert> <key>]", name);
 }
 
 int
 main(int argc, char **argv)
 {
-	char *end;
+	char *end, *name = argv[0];
+	int h2 = 0;
 
-	if(argc != 2) usage(argv[0]);
+	if(argc > 1 && strcmp(argv[1], "-2") == 0){
+		h2 = 1;
+		argc--;
+		argv++;
+	}
+	if(argc != 2 && (h2 || argc != 4)) usage(name);
 
-	int port = strtoul(argv[1], &end, 10);
-	if(port == 0 && (errno == EINVAL || errno == ERANGE))
-		panic("Invalid port \"%s\"", end);
+	// anything with a slash in it is a Unix domain socket's path
+	char *path = nil;
+	int port = 0;
+	if(strchr(argv[1], '/') != nil)
+		path = argv[1];
+	else{
+		port = strtoul(argv[1], &end, 10);
+		if(port == 0 && (errno == EINVAL || errno == ERANGE))
+			panic("Invalid port \"%s\"", end);
+	}
 
+	// clients that reset rather than close must not take the server with them
+	signal(SIGPIPE, SIG_IGN);
 	memset(content, 'Z', sizeof(content));
+	if(argc == 4)
+		tlsinit(argv[2], argv[3]);
 
-	serve("127.0.0.1", port);
+	if(h2)
+		serve2("127.0.0.1", port, path);
+	else
+		serve("127.0.0.1", port, path);
 	return 0;
 }
@@ -5,7 +5,10 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <netdb.h>
 
 #include <time.h>
@@ -13,16 +16,27 @@
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
 
 #include <event.h>
 #include <evhttp.h>
+#include <event2/bufferevent_ssl.h>
+#include <openssl/ssl.h>
 
 #include "u.h"
-
-#define NBUFFER 10
-#define MAX_BUCKETS 100
+#include "clk.h"
+#include "hist.h"
+#include "place.h"
+#include "src.h"
+#include "wheel.h"
+#include "hstress.h"
+#include "trace.h"
 
 #define OUTFILE_BUFFER_SIZE 4096
 #define DRAIN_BUFFER_SIZE 4096
@@ -30,88 +44,63 @@
 // cheap hack to get closer to our Hz target
 #define USEC_FUDGE -300
 
+// open-loop arrivals sent later than this after their slot count as late
+#define LATE_USEC 1000
+
+// requests are allocated this many at a time
+#define REQ_SLAB 64
+
 #define debug(s) ;
 //#define debug(s) fprintf(stderr, "run %d -> ", run->id); fprintf(stderr, s);
 
 char *http_hostname;
 uint16_t http_port;
+int http_unix;
 char http_hosthdr[2048];
 
-struct{
-    int count;
-    int concurrency;
-    int buckets[MAX_BUCKETS];
-    int nbuckets;
-    int rpc;
-    int qps;
-
-    // for logging output time
-    char *tsvout;
-    FILE *tsvoutfile;
-
-    // request path
-    char *path;
-    char *host_hdr;
-}params;
-
-struct{
-    int conns;
-    int conn_successes;
-    int counters[MAX_BUCKETS + 1];
-    int conn_errors;
-    int conn_timeouts;
-    int conn_closes;
-    int http_successes;
-    int http_errors;
-}counts;
-
-int num_cols = 6;
-
-struct request{
-    struct timeval           starttv;
-    struct event             timeoutev;
-    struct event             dispatchev;
-    int                      sock;
-    struct evhttp_connection *evcon;
-    struct evhttp_request    *evreq;
-    int                      evcon_reqno;
-};
-
-struct runner{
-    struct timeval            tv;
-    struct event              ev;
-    struct evhttp_connection *evcon;
-    struct request            *req;
-    int                       reqno;
-    int                       id;
-};
-typedef struct runner runner;
-
-int runid = 0;
+struct params params;
+struct engine *engine = &evhttpengine;
+struct ctl *ctl;
 
-enum{
-    Success,
-    Closed,
-    Error,
-    Timeout
-};
+/* percentiles reported per interval and at the end of the run */
+double pcts[NPCTS] = { 50, 90, 99, 99.9 };
 
 struct event    reportev;
 struct timeval  reporttv ={ 1, 0 };
-struct timeval  timeouttv ={ 1, 0 };
-struct timeval  lastreporttv;
-int             request_timeout;
-struct timeval  ratetv;
-int             ratecount = 0;
-int             nreport = 0;
-int             nreportbuf[NBUFFER];
-int             *reportbuf[NBUFFER];
+uint64_t        lastreport;
+uint64_t        runstart;
+
+worker          *workers;
+int             nworkers;
+int             ndone;
+
+/* workers write a byte here as they finish */
+int             donefds[2];
+struct event    doneev;
 
-void mkhttp(runner *run);
+/* and stop when this becomes readable */
+int             stopfds[2];
+int             stopping;
+
+/* aggregator state: run totals, and the last snapshot of each worker */
+struct stats    counts;
+struct stats    *lastsnap;
+struct stats    snap;
+struct stats    interval;
 
 void recvcb(struct evhttp_request *req, void *arg);
-void timeoutcb(int fd, short what, void *arg);
+int headercb(struct evhttp_request *req, void *arg);
+void bodycb(struct evhttp_request *req, void *arg);
+void connectcb(int fd, short what, void *arg);
+void timeoutcb(void *arg, Wentry *e);
 void closecb(struct evhttp_connection *evcon, void *arg);
+void evsentcb(struct evbuffer *buf, const struct evbuffer_cb_info *info, void *arg);
+int nextsrc(worker *w, struct sockaddr_storage *ss, socklen_t *len);
+
+void schedcb(int fd, short what, void *arg);
+void ready(runner *run);
+runner *unidle(struct sched *sc);
+void retire(runner *run);
 
 void report();
 void sigint(int which);
@@ -128,6 +117,12 @@ rpc_enabled()
     return params.rpc > 0;
 }
 
+unsigned char
+openloop_enabled()
+{
+    return params.rate > 0;
+}
+
 unsigned char
 tsv_enabled()
 {
@@ -139,74 +134,116 @@ tsv_enabled()
 */
 
 long
-milliseconds_since_start(struct timeval *tv)
+milliseconds_since_start(uint64_t since)
 {
-    long milliseconds;
-    struct timeval now, diff;
-
-    gettimeofday(&now, nil);
-    timersub(&now, tv, &diff);
-    milliseconds = diff.tv_sec * 1000L + diff.tv_usec / 1000L;
-
-    return milliseconds;
+    return (clknow() - since) / 1000;
 }
 
 long
-mkrate(struct timeval *tv, int count)
+mkrate(uint64_t since, int count)
 {
     long milliseconds;
-    milliseconds = milliseconds_since_start(tv);
+    milliseconds = milliseconds_since_start(since);
+    if(milliseconds == 0)
+        return 0;
     return(1000L * count / milliseconds);
 }
 
-void
-reset_time(struct timeval *tv)
+/* bytes over usec, in gigabits a second */
+double
+gbps(uint64_t bytes, uint64_t usec)
 {
-    gettimeofday(tv, nil);
+    return usec > 0 ? bytes * 8.0 / usec / 1000.0 : 0;
 }
 
 void
-reportcb(int fd, short what, void *arg)
+reset_time(uint64_t *t)
 {
-    int i;
-
-    printf("%d\t", nreport++);
-    printf("%d\t", counts.conn_successes);
-    printf("%d\t", counts.conn_errors);
-    printf("%d\t", counts.conn_timeouts);
-    printf("%d\t", counts.conn_closes);
-    printf("%d\t", counts.http_successes);
-    printf("%d\t", counts.http_errors);
-
-    counts.conn_successes = counts.conn_errors = counts.conn_timeouts = counts.conn_closes = counts.http_successes = counts.http_errors = 0;
-
-    for(i=0; params.buckets[i]!=0; i++)
-        printf("%d\t", counts.counters[i]);
+    *t = clknow();
+}
 
-    printf("%d\n", counts.counters[i]);
-    fflush(stdout);
+/*
+    Requests come off a per-worker free list, refilled a slab at a
+    time, so once a run has reached its peak number in flight it
+    allocates no more of them.
+*/
 
-    memset(counts.counters, 0, sizeof(counts.counters));
+struct request *
+reqalloc(worker *w)
+{
+    struct request *req;
+    int i;
 
-    if(params.count<0 || counts.conns<params.count){
-        evtimer_add(&reportev, &reporttv);
+    if(w->freereqs == nil){
+        if((req = calloc(REQ_SLAB, sizeof(*req))) == nil)
+            panic("calloc");
+        for(i=0; i<REQ_SLAB; i++){
+            req[i].next = w->freereqs;
+            w->freereqs = &req[i];
+        }
     }
+    req = w->freereqs;
+    w->freereqs = req->next;
+    memset(req, 0, sizeof(*req));
+    return req;
+}
+
+void
+reqfree(worker *w, struct request *req)
+{
+    req->next = w->freereqs;
+    w->freereqs = req;
 }
 
 /*
     HTTP, via libevent's HTTP support.
 */
 
+/*
+    What evhttp drains from its output buffer has been written (or,
+    with TLS, taken by SSL_write). When it gives up on a connection
+    it drops what was left, after taking the socket away.
+*/
+void
+evsentcb(struct evbuffer *buf, const struct evbuffer_cb_info *info, void *arg)
+{
+    runner *run = arg;
+    struct bufferevent *bev;
+
+    bev = evhttp_connection_get_bufferevent(run->evcon);
+    if(info->n_deleted > 0 && bufferevent_getfd(bev) >= 0)
+        add(run->w->stats->c.bytes_sent, info->n_deleted);
+}
+
 void
 mkhttp(runner *run)
 {
     struct evhttp_connection *evcon;
-
-    evcon = evhttp_connection_new(http_hostname, http_port);
+    struct bufferevent *bev;
+    struct sockaddr_storage ss;
+    socklen_t len;
+    char buf[INET6_ADDRSTRLEN];
+
+    if(params.tls){
+        bev = bufferevent_openssl_socket_new(run->w->base, -1, tlsnew(run),
+            BUFFEREVENT_SSL_CONNECTING, BEV_OPT_CLOSE_ON_FREE | BEV_OPT_DEFER_CALLBACKS);
+        if(bev == nil)
+            panic("bufferevent_openssl_socket_new");
+        evcon = evhttp_connection_base_bufferevent_new(run->w->base, nil, bev, http_hostname, http_port);
+    }else
+        evcon = evhttp_connection_base_new(run->w->base, nil, http_hostname, http_port);
     if(evcon == nil)
-        panic("evhttp_connection_new");
+        panic("evhttp_connection_base_new");
+
+    // libevent binds the socket itself, so it is given the address as text
+    if(nextsrc(run->w, &ss, &len))
+        evhttp_connection_set_local_address(evcon, srcname(&ss, buf, sizeof(buf)));
 
     evhttp_connection_set_closecb(evcon, &closecb, run);
+    evbuffer_add_cb(bufferevent_get_output(evhttp_connection_get_bufferevent(evcon)), &evsentcb, run);
+    run->evgen++;
+    if(params.stream && run->drain == nil)
+        run->drain = mal(DRAIN_BUFFER_SIZE);
     /*
         note: we manage our own per-request timeouts, since the underlying
         library does not give us enough error reporting fidelity
@@ -215,350 +252,1635 @@ mkhttp(runner *run)
 }
 
 void
-dispatch(runner *run, int reqno)
+evclose(runner *run)
 {
-    struct evhttp_connection *evcon = run->evcon;
-    struct evhttp_request *evreq;
-    struct request *req;
+    struct bufferevent *bev;
+
+    if(event_initialized(&run->connev))
+        event_del(&run->connev);
+    bev = evhttp_connection_get_bufferevent(run->evcon);
+    churnclose(bufferevent_getfd(bev));
+    if(params.tls)
+        tlsclose(bufferevent_openssl_get_ssl(bev));
+    evhttp_connection_free(run->evcon);
+    run->evcon = nil;
+}
 
-    if((req = calloc(1, sizeof(*req))) == nil)
-        panic("calloc");
+struct request *
+evnewreq(runner *run)
+{
+    return reqalloc(run->w);
+}
 
-    run->req = req;
-    req->evcon = evcon;
-    req->evcon_reqno = reqno;
+void
+evfreereq(runner *run, struct request *req)
+{
+    reqfree(run->w, req);
+}
+
+void
+evsend(runner *run, struct request *req)
+{
+    struct tmpl *t = &tmpls[req->tmpl];
+    struct evhttp_request *evreq;
+    struct bufferevent *bev;
+    char len[32];
+    int i, fd;
 
-    evreq = evhttp_request_new(&recvcb, run);
+    /*
+        evhttp would reconnect a connection the server has closed
+        with the same SSL, long past its handshake; it gets a new
+        connection instead.
+    */
+    bev = evhttp_connection_get_bufferevent(run->evcon);
+    if(params.tls && bufferevent_getfd(bev) < 0 && !SSL_in_before(bufferevent_openssl_get_ssl(bev))){
+        evclose(run);
+        mkhttp(run);
+    }
+
+    evreq = evhttp_request_new(&recvcb, req);
     if(evreq == nil)
         panic("evhttp_request_new");
+    evhttp_request_set_header_cb(evreq, &headercb);
+    if(params.stream)
+        evhttp_request_set_chunked_cb(evreq, &bodycb);
 
+    req->evcon = run->evcon;
+    req->evgen = run->evgen;
     req->evreq = evreq;
 
     evreq->response_code = -1;
-    evhttp_add_header(evreq->output_headers, "Host", http_hosthdr);
+    if(!t->hashost)
+        evhttp_add_header(evreq->output_headers, "Host", http_hosthdr);
+    for(i=0; i<t->nhdrs; i++)
+        evhttp_add_header(evreq->output_headers, t->keys[i], t->vals[i]);
+
+    // by reference: the mapping outlives every request
+    if(t->body != nil){
+        if(!t->haslen){
+            snprintf(len, sizeof(len), "%zu", t->bodylen);
+            evhttp_add_header(evreq->output_headers, "Content-Length", len);
+        }
+        evbuffer_add_reference(evhttp_request_get_output_buffer(evreq), t->body, t->bodylen, nil, nil);
+    }
 
-    gettimeofday(&req->starttv, nil);
-    evtimer_set(&req->timeoutev, timeoutcb, run);
-    evtimer_add(&req->timeoutev, &timeouttv);
-    debug("dispatch(): evtimer_add(&req->timeoutev, &timeouttv);\n");
+    /*
+        The connection is made, or made again after the server has
+        closed it, when a request is sent on it without a socket.
+        Its socket becomes writable once it is up.
+    */
+    bev = evhttp_connection_get_bufferevent(run->evcon);
+    fd = bufferevent_getfd(bev);
+    evhttp_make_request(run->evcon, evreq, t->evcmd, t->path);
+    if(fd < 0 && (fd = bufferevent_getfd(bev)) >= 0){
+        if(event_initialized(&run->connev))
+            event_del(&run->connev);
+        connecting(run);
+        event_set(&run->connev, fd, EV_WRITE, connectcb, run);
+        event_base_set(run->w->base, &run->connev);
+        event_add(&run->connev, nil);
+    }
+}
+
+void
+evexpire(struct request *req)
+{
+    runner *run = req->run;
+
+    /*
+        Freeing a connection drops whatever else was queued on it
+        (with -l) without a word; each of those ends up here when
+        its own timer runs out.
+    */
+    if(req->evgen != run->evgen){
+        complete(Error, req);
+        return;
+    }
+
+    /* re-establish the connection */
+    evclose(run);
+    mkhttp(run);
 
-    counts.conns++;
-    evhttp_make_request(evcon, evreq, EVHTTP_REQ_GET, params.path);
+    complete(Timeout, req);
 }
 
+struct engine evhttpengine = {
+    "evhttp",
+    nil,
+    mkhttp,
+    evclose,
+    evnewreq,
+    evfreereq,
+    evsend,
+    evexpire,
+};
+
+/*
+    Engines say when a runner starts to connect and when it has
+    connected, so that requests sent in between can be charged
+    for the wait.
+*/
 void
-save_request(int how, runner *run)
+connecting(runner *run)
 {
-    struct request *req = run->req;
-    int i;
-    long start_microseconds, now_microseconds, milliseconds;
-    struct timeval now, diff;
+    run->conngen++;
+    run->connat = 0;
+    bump(run->w->stats->c.conn_opens);
+}
 
-    gettimeofday(&now, nil);
+void
+connected(runner *run)
+{
+    run->connat = clknow();
+}
 
-    start_microseconds = req->starttv.tv_sec * 1000000 + req->starttv.tv_usec;
-    now_microseconds   = now.tv_sec * 1000000 + now.tv_usec;
+/*
+    With -B, workers take turns with the source addresses, so that
+    between them they go through every one in order.
+*/
+int
+nextsrc(worker *w, struct sockaddr_storage *ss, socklen_t *len)
+{
+    if(params.nsrcs == 0)
+        return 0;
+    srcaddr(w->srcnext, ss, len);
+    w->srcnext += nworkers;
+    return 1;
+}
+
+/*
+    The target's address for the engines that connect for
+    themselves: a Unix domain socket if the host is a path,
+    else the first of its addresses.
+*/
+void
+targetaddr(struct sockaddr_storage *ss, socklen_t *len)
+{
+    struct sockaddr_un *sun;
+    struct addrinfo hints, *res;
+    char port[16];
+    int err;
+
+    memset(ss, 0, sizeof(*ss));
+    if(http_unix){
+        sun = (struct sockaddr_un *)ss;
+        sun->sun_family = AF_UNIX;
+        if(strlen(http_hostname) >= sizeof(sun->sun_path))
+            panic("socket path too long: %s", http_hostname);
+        strcpy(sun->sun_path, http_hostname);
+        *len = sizeof(*sun);
+        return;
+    }
 
-    timersub(&now, &req->starttv, &diff);
-    milliseconds = (now_microseconds - start_microseconds)/1000;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof(port), "%d", http_port);
+    if((err = getaddrinfo(http_hostname, port, &hints, &res)) != 0)
+        panic("getaddrinfo %s: %s", http_hostname, gai_strerror(err));
+    memcpy(ss, res->ai_addr, res->ai_addrlen);
+    *len = res->ai_addrlen;
+    freeaddrinfo(res);
+}
 
-    if(tsv_enabled()) {
-        fprintf(params.tsvoutfile, "%ld\t%ld\t%d\n", start_microseconds, now_microseconds, how);
+/*
+    Bind fd to w's next source address, if any, before it connects.
+    The port is left to connect(), so that it need only be unique
+    per destination rather than per source address.
+*/
+void
+bindsrc(worker *w, int fd)
+{
+    struct sockaddr_storage ss;
+    socklen_t len;
+    char buf[INET6_ADDRSTRLEN];
+    int one = 1;
+
+    if(!nextsrc(w, &ss, &len))
+        return;
+    setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+    if(bind(fd, (struct sockaddr *)&ss, len) < 0)
+        panic("-B: bind %s: %s", srcname(&ss, buf, sizeof(buf)), strerror(errno));
+}
+
+/*
+    That the source addresses are of the target's family, and that
+    the first and last can be bound, before any worker tries.
+*/
+void
+checksrcs()
+{
+    struct sockaddr_storage ss;
+    struct addrinfo hints, *res;
+    socklen_t len;
+    char buf[INET6_ADDRSTRLEN];
+    uint64_t k;
+    int fd;
+
+    srcaddr(0, &ss, &len);
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = ss.ss_family;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(http_hostname, nil, &hints, &res) != 0)
+        panic("Invalid arguments: -B: %s has no %s address.", http_hostname, ss.ss_family == AF_INET ? "IPv4" : "IPv6");
+    freeaddrinfo(res);
+
+    for(k=0; k<params.nsrcs; k+=params.nsrcs-1 > 0 ? params.nsrcs-1 : 1){
+        srcaddr(k, &ss, &len);
+        if((fd = socket(ss.ss_family, SOCK_STREAM, 0)) < 0)
+            panic("socket: %s", strerror(errno));
+        if(bind(fd, (struct sockaddr *)&ss, len) < 0)
+            panic("Invalid arguments: -B: cannot bind %s: %s", srcname(&ss, buf, sizeof(buf)), strerror(errno));
+        close(fd);
     }
+}
+
+/*
+    With -K, connections are reset rather than closed with a FIN,
+    and so never sit in TIME_WAIT here holding on to a port. This
+    is connect() to AF_UNSPEC rather than SO_LINGER, so that the
+    shutdown()s evhttp and the uring engine do before they close
+    cannot send a FIN first.
+*/
+void
+churnclose(int fd)
+{
+    struct sockaddr sa;
+
+    if(!params.churn || fd < 0)
+        return;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_family = AF_UNSPEC;
+    connect(fd, &sa, sizeof(sa));
+}
+
+uint64_t
+bodysum(uint64_t h, char *p, size_t n)
+{
+    unsigned char *s = (unsigned char *)p, *e = s + n;
+
+    for(; s<e; s++)
+        h = (h ^ *s) * 0x100000001b3ULL;
+    return h;
+}
+
+/* whether req's body is the same as the first for its template */
+int
+sumok(struct request *req)
+{
+    uint64_t *s = &req->run->w->sums[req->tmpl];
+
+    if(*s == 0)
+        *s = req->sum;
+    return *s == req->sum;
+}
+
+void
+dispatch(runner *run)
+{
+    struct request *req;
+    int gen;
+
+    req = engine->newreq(run);
+
+    run->req = req;
+    run->inflight++;
+    req->run = run;
+    req->evcon_reqno = ++run->reqno;
+    req->tmpl = picktmpl(run->w);
+    req->status = -1;
+    req->sum = SUMINIT;
+
+    req->start = clk();
+    wheeladd(run->w->timeouts, &req->timeout, req->start + params.timeout*1000ULL);
+
+    bump(run->w->stats->c.conns);
+    gen = run->conngen;
+    engine->send(run, req);
+    req->waited = run->connat == 0 || run->conngen != gen;
+    req->conngen = run->conngen;
+}
+
+void
+save_request(int how, struct request *req)
+{
+    runner *run = req->run;
+    struct stats *st = run->w->stats;
+    int i, warm;
+    uint64_t end, usec, connect, ttfb;
+    long milliseconds;
+
+    end = clk();
+    usec = end - req->start;
+    milliseconds = usec/1000;
+
+    // phases are from the start, like the total; 0 if they did not happen
+    connect = ttfb = 0;
+    if(req->waited && req->conngen == run->conngen && run->connat != 0)
+        connect = run->connat - req->start;
+    if(req->first != 0)
+        ttfb = req->first - req->start;
+
+    // the clock is monotonic; these are written as times of day
+    warm = __atomic_load_n(&ctl->warm, __ATOMIC_RELAXED);
+    if(tsv_enabled() && warm) {
+        fprintf(params.tsvoutfile, "%" PRIu64 "\t%" PRIu64 "\t%d\t%" PRIu64 "\t%" PRIu64 "\n",
+            clkwall(req->start), clkwall(end), how, connect, ttfb);
+    }
+    if(run->w->trace != nil && warm)
+        tracerec(run->w->trace, clkwall(req->start), clkwall(end), how, connect, ttfb);
+
+    add(st->c.bytes_recvd, req->size);
 
     switch(how){
     case Success:
-        counts.conn_successes++;
-    switch(req->evreq->response_code){
+        bump(st->c.conn_successes);
+    switch(req->status){
         case 200:
+            if(params.checksum && !sumok(req)){
+                bump(st->c.body_errors);
+                bump(st->c.http_errors);
+                break;
+            }
             for(i=0; params.buckets[i]<milliseconds && params.buckets[i]!=0; i++);
-            counts.counters[i]++;
-            counts.http_successes++;
+            bump(st->c.counters[i]);
+            histrecord(&st->hist, usec);
+            if(connect != 0)
+                histrecord(&st->phase[Pconnect], connect);
+            if(ttfb != 0)
+                histrecord(&st->phase[Pttfb], ttfb);
+            histrecord(&st->size, req->size);
+            if(ntmpls > 1)
+                histrecord(&run->w->thist[req->tmpl], usec);
+            bump(st->c.http_successes);
             break;
         default:
-            counts.http_errors++;
+            bump(st->c.http_errors);
             break;
         }
         break;
     case Error:
-        counts.conn_errors++;
+        bump(st->c.conn_errors);
         break;
     case Timeout:
-        counts.conn_timeouts++;
+        bump(st->c.conn_timeouts);
         break;
     }
 }
 
+/*
+    Whether run may send another request now. A connection that has
+    carried its -r share is re-established here, but only once
+    everything sent on it has come back.
+*/
+int
+canissue(runner *run)
+{
+    if(run->retired || run->inflight >= params.depth)
+        return 0;
+    if(rpc_enabled() && run->reqno >= params.rpc){
+        if(run->inflight > 0)
+            return 0;
+        engine->close(run);
+        engine->open(run);
+        run->reqno = 0;
+    }
+    return 1;
+}
+
+/* keep the pipeline full */
+void
+refill(runner *run)
+{
+    worker *w = run->w;
+
+    while((params.count<0 || w->stats->c.conns<params.count) && canissue(run))
+        dispatch(run);
+}
+
+/*
+    Requests are handed back here by the engine. Engines may reuse
+    req for the next one sent, so nothing here touches it after
+    another request might have gone out.
+*/
+void
+complete(int how, struct request *req)
+{
+    runner *run = req->run;
+    worker *w = run->w;
+
+    save_request(how, req);
+
+    wheeldel(w->timeouts, &req->timeout);
+
+    run->inflight--;
+    engine->freereq(run, req);
+
+    /* enqueue the next one */
+    if(params.count<0 || w->stats->c.conns<params.count){
+        // re-scheduling is handled by the callback
+        if(openloop_enabled())
+            ready(run);
+        else if(!qps_enabled())
+            refill(run);
+    }else{
+        if(openloop_enabled() && !w->sched.done){
+            w->sched.done = 1;
+            evtimer_del(&w->sched.ev);
+            while(w->sched.nidle > 0)
+                retire(unidle(&w->sched));
+        }
+        retire(run);
+    }
+}
+
+/*
+    Stop run sending. Its connection goes once whatever is still in
+    flight on it has completed; complete() calls back in for that.
+*/
+void
+retire(runner *run)
+{
+    worker *w = run->w;
+
+    if(qps_enabled())
+        evtimer_del(&run->ev);
+    if(run->retired || run->inflight > 0)
+        return;
+    run->retired = 1;
+
+    /* We'll count this as a close. I guess that's ok. */
+    engine->close(run);
+    if(--w->concurrency == 0){
+        debug("last runner retired\n");
+        event_base_loopexit(w->base, nil);
+    }
+}
+
+void
+runnercb(int fd, short what, void *arg)
+{
+    runner *run = (runner *)arg;
+    debug("runnercb()\n");
+    clkstale();
+    if(qps_enabled()) {
+        event_add(&run->ev, &run->tv);
+    }
+
+    dispatch(run);
+}
+
+/**
+ start a new, potentially, rate-limited run
+ */
+void
+mkrunner(worker *w)
+{
+    runner *run = &w->runners[w->runid];
+
+    run->id = w->runid++;
+    run->w = w;
+
+    engine->open(run);
+
+    if(openloop_enabled()) {
+        // the arrival schedule hands out the work
+        ready(run);
+    } else if(qps_enabled()) {
+        run->tv.tv_sec = 0;
+        run->tv.tv_usec = 1000000/params.qps + USEC_FUDGE;
+
+        if(run->tv.tv_usec < 1)
+            run->tv.tv_usec = 1;
+
+        evtimer_set(&run->ev, runnercb, run);
+        event_base_set(w->base, &run->ev);
+        evtimer_add(&run->ev, &run->tv);
+        debug("mkrunner(): evtimer_add(&run->ev, &run->tv);\n");
+    } else {
+        // skip the timers and just loop as fast as possible
+        refill(run);
+    }
+}
+
+/*
+    Open-loop arrivals.
+
+    With -R, requests arrive on a schedule fixed in advance, not when
+    earlier requests complete. Each arrival goes to an idle runner
+    (one with room in its pipeline), or waits in a backlog for the
+    next one to free up. Either way its latency is measured from the
+    slot it was scheduled for, so a server stall is charged in full
+    to every request queued behind it instead of silently pushing
+    them back.
+*/
+
+double
+interarrival(struct sched *sc)
+{
+    if(params.poisson)
+        return -log(1.0 - erand48(sc->xsubi)) * 1e6 / sc->rate;
+
+    return 1e6 / sc->rate;
+}
+
+void
+arrive(runner *run, double intended)
+{
+    struct request *req;
+
+    dispatch(run);
+
+    req = run->req;
+    if(req->start - intended > LATE_USEC)
+        bump(run->w->stats->c.late);
+
+    req->start = (uint64_t)intended;
+}
+
+void
+ready(runner *run)
+{
+    struct sched *sc = &run->w->sched;
+    double intended;
+
+    while(sc->nbacklog > 0 && canissue(run)){
+        intended = sc->backlog[sc->backloghead++];
+        sc->nbacklog--;
+        arrive(run, intended);
+    }
+    if(sc->done)
+        retire(run);
+    else if(!run->idle && canissue(run)){
+        run->idle = 1;
+        sc->idle[sc->nidle++] = run;
+    }
+}
+
+/* run is done with the idle list, for now or for good */
+runner *
+unidle(struct sched *sc)
+{
+    runner *run = sc->idle[--sc->nidle];
+
+    run->idle = 0;
+    return run;
+}
+
+void
+enqueue(struct sched *sc, double intended)
+{
+    if(sc->backloghead + sc->nbacklog == sc->backlogsz){
+        if(sc->backloghead > sc->backlogsz/2){
+            memmove(sc->backlog, sc->backlog + sc->backloghead,
+                sc->nbacklog * sizeof(double));
+        }else{
+            sc->backlogsz = sc->backlogsz ? 2*sc->backlogsz : 1024;
+            sc->backlog = remal(sc->backlog, sc->backlogsz * sizeof(double));
+            memmove(sc->backlog, sc->backlog + sc->backloghead,
+                sc->nbacklog * sizeof(double));
+        }
+        sc->backloghead = 0;
+    }
+    sc->backlog[sc->backloghead + sc->nbacklog++] = intended;
+}
+
+void
+schedcb(int fd, short what, void *arg)
+{
+    worker *w = (worker *)arg;
+    struct sched *sc = &w->sched;
+    struct timeval tv;
+    runner *run;
+    double t, wait;
+
+    clkstale();
+    t = clk();
+
+    /*
+        A new rate starts a new schedule. Arrivals still owed from
+        the old one are not sent: they would be judged at the new.
+    */
+    if(__atomic_load_n(&ctl->gen, __ATOMIC_ACQUIRE) != sc->gen){
+        sc->gen = ctl->gen;
+        sc->rate = ctl->rate;
+        sc->backloghead = sc->nbacklog = 0;
+        sc->next = t;
+    }
+
+    while(sc->next <= t){
+        if(params.count >= 0 && w->stats->c.conns + sc->nbacklog >= params.count){
+            // whoever is still idle will not be needed again
+            sc->done = 1;
+            while(sc->nidle > 0)
+                retire(unidle(sc));
+            return;
+        }
+
+        if(sc->nidle > 0){
+            run = sc->idle[sc->nidle-1];
+            arrive(run, sc->next);
+            if(!canissue(run))
+                unidle(sc);
+        }else
+            enqueue(sc, sc->next);
+
+        sc->next += interarrival(sc);
+    }
+
+    wait = sc->next - t;
+    tv.tv_sec = (long)(wait / 1e6);
+    tv.tv_usec = (long)(wait - tv.tv_sec * 1e6);
+    evtimer_add(&sc->ev, &tv);
+}
+
+void
+mksched(worker *w)
+{
+    struct sched *sc = &w->sched;
+    uint64_t now;
+    long seed;
+
+    if((sc->idle = calloc(params.concurrency, sizeof(runner *))) == nil)
+        panic("calloc");
+
+    now = clknow();
+    seed = getpid() ^ now ^ (w->id << 20);
+    sc->xsubi[0] = 0x330e;
+    sc->xsubi[1] = seed;
+    sc->xsubi[2] = seed >> 16;
+
+    sc->next = now;
+    sc->gen = -1;
+    evtimer_set(&sc->ev, schedcb, w);
+    event_base_set(w->base, &sc->ev);
+    schedcb(0, 0, w);
+}
+
+void
+recvcb(struct evhttp_request *evreq, void *arg)
+{
+    struct request *req = (struct request *)arg;
+    int status = Success;
+
+    clkstale();
+
+    /*
+        It seems that, under certain circumstances,
+        evreq may be null on failure.
+
+        we'll count it as an error.
+    */
+
+    if(evreq == nil || evreq->response_code < 0)
+        status = Error;
+    else{
+        req->status = evreq->response_code;
+        req->size += evbuffer_get_length(evhttp_request_get_input_buffer(evreq));
+    }
+
+    complete(status, req);
+}
+
+/* the response's status line and headers are in */
+int
+headercb(struct evhttp_request *evreq, void *arg)
+{
+    struct request *req = (struct request *)arg;
+    struct evkeyval *kv;
+    const char *line;
+
+    clkstale();
+    req->first = clk();
+
+    // as near as can be told once parsed: HTTP/1.x NNN line, headers, CRLF
+    line = evhttp_request_get_response_code_line(evreq);
+    req->size = 13 + (line != nil ? strlen(line) : 0) + 2 + 2;
+    for(kv=evhttp_request_get_input_headers(evreq)->tqh_first; kv!=nil; kv=kv->next.tqe_next)
+        req->size += strlen(kv->key) + 2 + strlen(kv->value) + 2;
+    return 0;
+}
+
+/*
+    With -s, the body so far, which libevent empties once this
+    returns. It passes through one buffer per runner.
+*/
+void
+bodycb(struct evhttp_request *evreq, void *arg)
+{
+    struct request *req = (struct request *)arg;
+    struct evbuffer *buf = evhttp_request_get_input_buffer(evreq);
+    char *drain = req->run->drain;
+    int n;
+
+    while((n = evbuffer_remove(buf, drain, DRAIN_BUFFER_SIZE)) > 0){
+        req->size += n;
+        if(params.checksum)
+            req->sum = bodysum(req->sum, drain, n);
+    }
+}
+
+/* a runner's socket is writable: it has connected, or failed to */
+void
+connectcb(int fd, short what, void *arg)
+{
+    clkstale();
+    connected((runner *)arg);
+}
+
+void
+timeoutcb(void *arg, Wentry *e)
+{
+    struct request *req;
+    debug("timeoutcb()\n");
+
+    req = (struct request *)((char *)e - offsetof(struct request, timeout));
+    engine->expire(req);
+}
+
+void
+closecb(struct evhttp_connection *evcon, void *arg)
+{
+    runner *run = (runner *)arg;
+    debug("closecb()\n");
+    bump(run->w->stats->c.conn_closes);
+}
+
+/*
+    Workers.
+*/
+
+void
+stopcb(int fd, short what, void *arg)
+{
+    worker *w = (worker *)arg;
+
+    event_base_loopexit(w->base, nil);
+}
+
+/*
+    With -A or -N a worker is placed before it allocates anything,
+    so that its memory comes from its own node: the event base,
+    requests, buffers, and its stats block, which nothing touches
+    before the worker does.
+*/
+void
+place(int cpu, int node)
+{
+    if(cpu >= 0)
+        pincpu(cpu);
+    else if(node >= 0)
+        pinnode(node);
+}
+
+void *
+work(void *arg)
+{
+    worker *w = (worker *)arg;
+    struct event_config *cfg;
+    struct event stopev;
+    char path[1024];
+    int i;
+
+    place(w->cpu, w->node);
+    w->stats->start = clknow();
+    w->xsubi[0] = 0x330e ^ w->id;
+    w->xsubi[1] = getpid();
+    w->xsubi[2] = w->stats->start;
+
+    if((cfg = event_config_new()) == nil)
+        panic("event_config_new");
+    /*
+        epoll timeouts are rounded up to whole milliseconds unless
+        asked otherwise, which would make every open-loop arrival late
+    */
+    if(openloop_enabled())
+        event_config_set_flag(cfg, EVENT_BASE_FLAG_PRECISE_TIMER);
+    if((w->base = event_base_new_with_config(cfg)) == nil)
+        panic("event_base_new_with_config");
+    event_config_free(cfg);
+
+    if(params.traceout != nil){
+        snprintf(path, sizeof(path), "%s.%d", params.traceout, w->id);
+        w->trace = mktrace(path);
+    }
+
+    w->timeouts = mkwheel(w->base, params.timeout*1000ULL, timeoutcb, w);
+    if(params.checksum && (w->sums = calloc(ntmpls, sizeof(uint64_t))) == nil)
+        panic("calloc");
+
+    event_set(&stopev, stopfds[0], EV_READ, stopcb, w);
+    event_base_set(w->base, &stopev);
+    event_add(&stopev, nil);
+
+    w->concurrency = params.concurrency;
+    if((w->runners = calloc(params.concurrency, sizeof(runner))) == nil)
+        panic("calloc");
+
+    if(openloop_enabled())
+        mksched(w);
+
+    clkstale();
+    for(i=0; i<params.concurrency; i++)
+        mkrunner(w);
+
+    event_base_dispatch(w->base);
+    event_del(&stopev);
+
+    if(tsv_enabled())
+        fflush(params.tsvoutfile);
+    if(w->trace != nil)
+        traceclose(w->trace);
+
+    w->stats->end = clknow();
+    __atomic_store_n(&w->stats->done, 1, __ATOMIC_RELEASE);
+    if(write(donefds[1], "", 1) != 1)
+        panic("write");
+    return nil;
+}
+
+void
+startworker(worker *w)
+{
+    if(params.threads){
+        if(pthread_create(&w->thread, nil, work, w) != 0)
+            panic("pthread_create");
+        return;
+    }
+
+    if((w->pid = fork()) < 0){
+        kill(0, SIGINT);
+        perror("fork");
+        exit(1);
+    }else if(w->pid != 0)
+        return;
+
+    // the parent stops us, or its death does
+    signal(SIGINT, SIG_IGN);
+    close(stopfds[1]);
+    if(params.agentfd >= 0)
+        close(params.agentfd);
+
+    // create a buffer for this process
+    if(tsv_enabled()) {
+        char *out = mal(sizeof(char) * OUTFILE_BUFFER_SIZE);
+        setvbuf(params.tsvoutfile, out, _IOLBF, OUTFILE_BUFFER_SIZE);
+    }
+
+    work(w);
+    exit(0);
+}
+
+/*
+    Aggregation.
+
+    Workers only ever add to their own struct stats, which lives in
+    a shared mapping so the aggregator can see it whether workers are
+    processes or threads. Every interval the aggregator snapshots
+    each worker, prints the difference from the previous snapshot
+    and folds it into the run totals. Nothing is serialized, and a
+    slow worker simply contributes less to an interval.
+*/
+
+void
+snapshot(struct stats *dst, struct stats *src)
+{
+    uint64_t *d = (uint64_t *)&dst->c, *s = (uint64_t *)&src->c;
+    int i;
+
+    // read done first: once it is set, all of the counts are final
+    dst->done = __atomic_load_n(&src->done, __ATOMIC_ACQUIRE);
+    for(i=0; i<NCOUNTERS; i++)
+        d[i] = __atomic_load_n(&s[i], __ATOMIC_RELAXED);
+    histsnap(&dst->hist, &src->hist);
+    for(i=0; i<Nphase; i++)
+        histsnap(&dst->phase[i], &src->phase[i]);
+    histsnap(&dst->size, &src->size);
+}
+
+void
+accumulate(struct stats *dst, struct stats *cur, struct stats *last)
+{
+    uint64_t *d = (uint64_t *)&dst->c;
+    uint64_t *c = (uint64_t *)&cur->c, *l = (uint64_t *)&last->c;
+    int i;
+
+    for(i=0; i<NCOUNTERS; i++)
+        d[i] += c[i] - l[i];
+    histdelta(&dst->hist, &cur->hist, &last->hist);
+    for(i=0; i<Nphase; i++)
+        histdelta(&dst->phase[i], &cur->phase[i], &last->phase[i]);
+    histdelta(&dst->size, &cur->size, &last->size);
+}
+
 void
-complete(int how, runner *run)
+merge(struct stats *dst, struct stats *src)
 {
-    struct request *req = run->req;
-    save_request(how, run);
+    uint64_t *d = (uint64_t *)&dst->c, *s = (uint64_t *)&src->c;
+    int i;
 
-    evtimer_del(&req->timeoutev);
-    debug("complete(): evtimer_del(&req->timeoutev);\n");
+    for(i=0; i<NCOUNTERS; i++)
+        d[i] += s[i];
+    histmerge(&dst->hist, &src->hist);
+    for(i=0; i<Nphase; i++)
+        histmerge(&dst->phase[i], &src->phase[i]);
+    histmerge(&dst->size, &src->size);
+}
 
-    /* enqueue the next one */
-    if(params.count<0 || counts.conns<params.count){
-        // re-scheduling is handled by the callback
-        if(!qps_enabled()){
-            if(!rpc_enabled() || req->evcon_reqno<params.rpc){
-                dispatch(run, req->evcon_reqno + 1);
-            }else{
-                // re-establish the connection
-                evhttp_connection_free(run->evcon);
-                mkhttp(run);
-                dispatch(run, 1);
-            }
-        }
-    }else{
-        /* We'll count this as a close. I guess that's ok. */
-        evhttp_connection_free(req->evcon);
-        if(--params.concurrency == 0){
-            evtimer_del(&reportev);
-            debug("last call to reportcb\n");
-            reportcb(0, 0, nil);  /* issue a last report */
+/* reap worker processes that died without saying they were done */
+void
+reap()
+{
+    pid_t pid;
+    int i, status;
+
+    if(params.threads)
+        return;
+
+    while((pid = waitpid(-1, &status, WNOHANG)) > 0){
+        for(i=0; i<nworkers; i++){
+            if(workers[i].pid == pid)
+                __atomic_store_n(&workers[i].stats->done, 1, __ATOMIC_RELEASE);
         }
     }
+}
+
+/*
+    Capacity search.
+
+    With -S the run is a series of steps, each at a fixed open-loop
+    rate. The first interval of a step lets requests sent at the
+    last rate drain and is not judged; the step passes if every
+    bound in the SLO holds over the next slo.step intervals taken
+    together. The rate doubles from -R until a step fails, then
+    bisects between the best rate that passed and the worst that
+    failed until they are within slo.prec percent of each other.
+*/
+
+#define MAXSLO 8
+
+struct slo{
+    int     npct;
+    double  pct[MAXSLO];
+    double  ms[MAXSLO];         /* pct[i] must be under ms[i] */
+    double  err;                /* percent of requests failing, or -1 */
+    int     step;
+    double  prec;
+} slo;
+
+struct search{
+    double          rate;       /* this step's, in total */
+    double          pass;       /* best that passed, or 0 */
+    double          fail;       /* worst that failed, or 0 */
+    int             nstep;
+    int             tick;       /* intervals into this step */
+    uint64_t        start;      /* of the judged part */
+    struct stats    acc;
+} search;
+
+/* p99=50,p99.9=200,err=0.1,step=5,prec=2 */
+void
+parseslo(char *spec)
+{
+    char *s, *k, *v;
+
+    slo.npct = 0;
+    slo.err = -1;
+    slo.step = 5;
+    slo.prec = 2;
+
+    s = strdup(spec);
+    while((k = strsep(&s, ",")) != nil){
+        if((v = strchr(k, '=')) == nil)
+            panic("Invalid arguments: -S: want KEY=VALUE, not \"%s\".", k);
+        *v++ = '\0';
+        if(k[0] == 'p' && k[1] != 'r'){
+            if(slo.npct == MAXSLO)
+                panic("Invalid arguments: -S: too many percentiles.");
+            slo.pct[slo.npct] = atof(k+1);
+            slo.ms[slo.npct++] = atof(v);
+        }else if(strcmp(k, "err") == 0)
+            slo.err = atof(v);
+        else if(strcmp(k, "step") == 0)
+            slo.step = atoi(v);
+        else if(strcmp(k, "prec") == 0)
+            slo.prec = atof(v);
+        else
+            panic("Invalid arguments: -S: unknown \"%s\".", k);
+    }
+    if(slo.npct == 0 && slo.err < 0)
+        panic("Invalid arguments: -S: no percentile or error bound.");
+    if(slo.step < 1 || slo.prec <= 0)
+        panic("Invalid arguments: -S: step and prec must be positive.");
+}
 
-    if(!qps_enabled())
-      // FIXME possible memory leak
-      free(req);
+/* the workers' rate, as a total */
+void
+setrate(double rate)
+{
+    search.rate = rate;
+    ctl->rate = rate / nworkers;
+    __atomic_store_n(&ctl->gen, ctl->gen + 1, __ATOMIC_RELEASE);
 }
 
 void
-runnercb(int fd, short what, void *arg)
+stopworkers()
 {
-    runner *run = (runner *)arg;
-    debug("runnercb()\n");
-    if(qps_enabled()) {
-        event_add(&run->ev, &run->tv);
+    if(!stopping++ && write(stopfds[1], "", 1) != 1)
+        panic("write");
+}
+
+/* judge the step just ended; returns whether it passed */
+int
+judge(struct stats *st, double secs)
+{
+    struct counters *c = &st->c;
+    uint64_t total, failed;
+    double errpct, ms;
+    int i, ok;
+
+    total = c->conn_successes + c->conn_errors + c->conn_timeouts;
+    failed = c->conn_errors + c->conn_timeouts + c->http_errors;
+    errpct = total > 0 ? 100.0 * failed / total : 100;
+    ok = total > 0 && (slo.err < 0 || errpct <= slo.err);
+
+    fprintf(stderr, "# step %-4d\t%.0f\t%.0f", search.nstep, search.rate, c->conn_successes / secs);
+    for(i=0; i<slo.npct; i++){
+        ms = histpct(&st->hist, slo.pct[i]) / 1000.0;
+        fprintf(stderr, "\t%.3f", ms);
+        if(ms >= slo.ms[i])
+            ok = 0;
     }
+    fprintf(stderr, "\t%.3f\t%" PRIu64 "\t%s\n", errpct, c->late, ok ? "pass" : "fail");
+    return ok;
+}
+
+void
+searchcb(struct stats *iv)
+{
+    double next;
+    int i;
 
-    dispatch(run, run->reqno + 1);
+    if(stopping)
+        return;
+    if(search.tick++ == 0){
+        memset(&search.acc, 0, sizeof(search.acc));
+        search.start = clknow();
+        return;
+    }
+    merge(&search.acc, iv);
+    if(search.tick <= slo.step)
+        return;
+
+    if(search.nstep++ == 0){
+        fprintf(stderr, "# step\t\trate\thz");
+        for(i=0; i<slo.npct; i++)
+            fprintf(stderr, "\tp%g<%g", slo.pct[i], slo.ms[i]);
+        fprintf(stderr, "\terr%%\tlate\n");
+    }
+    if(judge(&search.acc, (clknow() - search.start) / 1e6))
+        search.pass = search.rate;
+    else
+        search.fail = search.rate;
+
+    if(search.fail == 0)
+        next = 2 * search.rate;
+    else if(search.pass == 0)
+        next = search.rate / 2;
+    else
+        next = (search.pass + search.fail) / 2;
+
+    if((search.pass > 0 && search.fail > 0 && search.fail - search.pass <= search.pass * slo.prec / 100)
+    || (search.pass == 0 && next < 1)){
+        fprintf(stderr, "# capacity\t\t%.0f\n", search.pass);
+        stopworkers();
+        return;
+    }
+    search.tick = 0;
+    setrate(next);
 }
 
-/**
- start a new, potentially, rate-limited run
- */
+/*
+    Warmup.
+
+    With -w the start of the run is left out of the summary: a
+    number of requests (-w 10000), a time (-w 30s, -w 500ms), or
+    with -w auto, however long it takes the run to settle. Settled
+    is the last WARMWIN intervals' rates varying by no more than
+    WARMHZ percent (standard deviation over mean), and their p50s
+    and p99s, which are noisier, by no more than WARMPCT; if that has
+    not happened after WARMMAX intervals the rest is recorded anyway.
+    Warmup ends with an interval, so it takes whole intervals; those
+    are printed commented out, and the summary, its rates included,
+    starts over after them.
+*/
+
+#define WARMWIN 5
+#define WARMHZ 5.0
+#define WARMPCT 10.0
+#define WARMMAX 60
+
+struct warm{
+    int             on;         /* still warming up */
+    int             n;          /* intervals so far */
+    uint64_t        reqs;
+    uint64_t        usec;
+    double          hz[WARMWIN];
+    double          p50[WARMWIN];
+    double          p99[WARMWIN];
+} warm;
+
+/* 10000, 30s, 500ms or auto */
 void
-mkrunner()
+parsewarm(char *arg)
 {
-    runner *run = calloc(1, sizeof(runner));
-    run->id = runid++;
+    char *end;
+    double v;
 
-    if(run == nil)
-        panic("calloc");
+    params.warmup = arg;
+    if(strcmp(arg, "auto") == 0){
+        params.warmauto = 1;
+        return;
+    }
+    v = strtod(arg, &end);
+    if(end == arg || v < 0)
+        panic("Invalid arguments: -w (WARMUP) takes a count, a time like 30s or 500ms, or auto.");
+    if(strcmp(end, "s") == 0)
+        params.warmusec = v * 1e6;
+    else if(strcmp(end, "ms") == 0)
+        params.warmusec = v * 1e3;
+    else if(*end == '\0')
+        params.warmn = v;
+    else
+        panic("Invalid arguments: -w (WARMUP) takes a count, a time like 30s or 500ms, or auto.");
+}
 
-    mkhttp(run);
+/* how much v[0..n) varies, in percent of its mean */
+double
+spread(double *v, int n)
+{
+    double mean, var;
+    int i;
 
-    if(qps_enabled()) {
-        run->tv.tv_sec = 0;
-        run->tv.tv_usec = 1000000/params.qps + USEC_FUDGE;
+    mean = var = 0;
+    for(i=0; i<n; i++)
+        mean += v[i] / n;
+    if(mean <= 0)
+        return HUGE_VAL;
+    for(i=0; i<n; i++)
+        var += (v[i] - mean) * (v[i] - mean) / n;
+    return 100 * sqrt(var) / mean;
+}
 
-        if(run->tv.tv_usec < 1)
-            run->tv.tv_usec = 1;
+/* whether the last WARMWIN intervals, the newest st, are alike */
+int
+settled(struct stats *st, uint64_t usec)
+{
+    int k;
+
+    k = (warm.n - 1) % WARMWIN;
+    warm.hz[k] = usec > 0 ? st->c.conn_successes * 1e6 / usec : 0;
+    warm.p50[k] = histpct(&st->hist, 50);
+    warm.p99[k] = histpct(&st->hist, 99);
+    return warm.n >= WARMWIN
+        && spread(warm.hz, WARMWIN) <= WARMHZ
+        && spread(warm.p50, WARMWIN) <= WARMPCT
+        && spread(warm.p99, WARMWIN) <= WARMPCT;
+}
 
-        evtimer_set(&run->ev, runnercb, run);
-        evtimer_add(&run->ev, &run->tv);
-        debug("mkrunner(): evtimer_add(&run->ev, &run->tv);\n");
-    } else {
-        // skip the timers and just loop as fast as possible
-        runnercb(0, 0, run);
+/* st, over usec, is in the totals; if it ends the warmup, start them over */
+void
+warmup(struct stats *st, uint64_t usec)
+{
+    struct counters *c = &st->c;
+    int i, j;
+
+    if(!warm.on)
+        return;
+    warm.n++;
+    warm.reqs += c->conn_successes + c->conn_errors + c->conn_timeouts;
+    warm.usec += usec;
+    if(params.warmauto){
+        if(!settled(st, usec) && warm.n < WARMMAX)
+            return;
+        if(warm.n == WARMMAX)
+            fprintf(stderr, "# warmup: not settled after %d intervals\n", warm.n);
+    }else if(warm.reqs < params.warmn || warm.usec < params.warmusec)
+        return;
+
+    warm.on = 0;
+    fprintf(stderr, "# warmup\t\t%.3f\t%" PRIu64 "\n", warm.usec / 1e6, warm.reqs);
+    memset(&counts, 0, sizeof(counts));
+    runstart = clknow();
+
+    // what the workers have done so far, for reporttmpls and reportworkers
+    for(i=0; i<nworkers; i++){
+        workers[i].warmn = lastsnap[i].c.conn_successes;
+        if(ntmpls > 1){
+            workers[i].warmthist = mal(ntmpls * sizeof(Hist));
+            for(j=0; j<ntmpls; j++)
+                histsnap(&workers[i].warmthist[j], &workers[i].thist[j]);
+        }
     }
+    if(ctl != nil)
+        __atomic_store_n(&ctl->warm, 1, __ATOMIC_RELAXED);
 }
 
 void
-recvcb(struct evhttp_request *evreq, void *arg)
+reportcb(int fd, short what, void *arg)
 {
+    uint64_t usec;
+    int i;
 
-    int status = Success;
+    reap();
 
-    /*
-        It seems that, under certain circumstances,
-        evreq may be null on failure.
+    memset(&interval, 0, sizeof(interval));
+    ndone = 0;
+    for(i=0; i<nworkers; i++){
+        snapshot(&snap, workers[i].stats);
+        accumulate(&interval, &snap, &lastsnap[i]);
+        lastsnap[i] = snap;
+        ndone += snap.done;
+    }
 
-        we'll count it as an error.
-    */
+    usec = clknow() - lastreport;
+    printinterval((int)time(nil), &interval, usec);
+    if(params.agentfd >= 0)
+        agentsend(&interval);
+    reset_time(&lastreport);
 
-    if(evreq == nil || evreq->response_code < 0)
-        status = Error;
+    /* Aggregate. */
+    merge(&counts, &interval);
+    warmup(&interval, usec);
+    if(params.slo != nil)
+        searchcb(&interval);
 
-    complete(status, (runner *)arg);
+    if(ndone < nworkers)
+        evtimer_add(&reportev, &reporttv);
+    else{
+        event_del(&doneev);
+        if(params.agentfd >= 0)
+            agentdone();
+        metricsdone();
+    }
 }
 
+/* an interval's line, stamped ts, for st gathered over usec */
 void
-timeoutcb(int fd, short what, void *arg)
+printinterval(int ts, struct stats *st, uint64_t usec)
 {
-    runner *run = (runner *)arg;
-    debug("timeoutcb()\n");
-
-    /* re-establish the connection */
-    evhttp_connection_free(run->evcon);
-    mkhttp(run);
+    struct counters *c = &st->c;
+    int i;
 
-    complete(Timeout, run);
+    metricsnote(st, usec);
+    heatnote(ts, &st->hist);
+    if(warm.on)
+        printf("#");
+    printf("%d\t", ts);
+    printf("%" PRIu64 "\t", c->conn_successes);
+    printf("%" PRIu64 "\t", c->conn_errors);
+    printf("%" PRIu64 "\t", c->conn_timeouts);
+    printf("%" PRIu64 "\t", c->conn_closes);
+    printf("%" PRIu64 "\t", c->http_successes);
+    printf("%" PRIu64 "\t", c->http_errors);
+    for(i=0; i<params.nbuckets; i++)
+        printf("%" PRIu64 "\t", c->counters[i]);
+    printf("%ld", usec > 0 ? (long)(c->conn_successes * 1000000 / usec) : 0);
+    for(i = 0; i < NPCTS; i++)
+        printf("\t%.3f", histpct(&st->hist, pcts[i])/1000.0);
+    printf("\t%.3f\t%.3f", gbps(c->bytes_sent, usec), gbps(c->bytes_recvd, usec));
+    if(openloop_enabled())
+        printf("\t%" PRIu64, c->late);
+    printf("\n");
+    fflush(stdout);
 }
 
+/* as soon as the last worker is done, issue a last report */
 void
-closecb(struct evhttp_connection *evcon, void *arg)
+donecb(int fd, short what, void *arg)
 {
-    runner *run = (runner *)arg;
-    debug("closecb()\n");
-    counts.conn_closes++;
-}
+    char buf[64];
+    int i, n;
 
+    if((n = read(fd, buf, sizeof(buf))) <= 0)
+        return;
 
-/*
-    Aggregation.
-*/
+    for(i=0, n=0; i<nworkers; i++)
+        n += __atomic_load_n(&workers[i].stats->done, __ATOMIC_ACQUIRE);
+    if(n == nworkers){
+        evtimer_del(&reportev);
+        reportcb(0, 0, nil);
+    }
+}
 
 void
-chldreadcb(struct bufferevent *b, void *arg)
+parentd()
 {
-    char *line, *sp, *ap;
-    int n, i, nprocs = *(int *)arg;
+    struct event_base *base;
+    int i, status;
 
-    if((line=evbuffer_readline(b->input)) != nil){
-        sp = line;
+    place(params.aggcpu, params.aggnode);
+    signal(SIGINT, sigint);
 
-        if((ap = strsep(&sp, "\t")) == nil)
-            panic("report error\n");
-        n = atoi(ap);
-        if(n - nreport > NBUFFER)
-            panic("a process fell too far behind\n");
+    runstart = lastreport = clknow();
 
-        n %= NBUFFER;
+    if((lastsnap = calloc(nworkers, sizeof(struct stats))) == nil)
+        panic("calloc");
 
-        for(i=0; i<params.nbuckets + num_cols && (ap=strsep(&sp, "\t")) != nil; i++)
-            reportbuf[n][i] += atoi(ap);
+    base = event_init();
+    if(params.metrics != nil)
+        mkmetrics(base, params.metrics);
 
-        if(++nreportbuf[n] >= nprocs){
-            /* Timestamp it.  */
-            printf("%d\t",(int)time(nil));
-            for(i = 0; i < params.nbuckets + num_cols; i++)
-                printf("%d\t", reportbuf[n][i]);
-            printf("%ld\n", mkrate(&lastreporttv, reportbuf[n][0]));
-            reset_time(&lastreporttv);
+    /* event handler for reports */
+    evtimer_set(&reportev, reportcb, nil);
+    evtimer_add(&reportev, &reporttv);
 
-            /* Aggregate. */
-            counts.conn_successes += reportbuf[n][0];
-            counts.conn_errors += reportbuf[n][1];
-            counts.conn_timeouts += reportbuf[n][2];
-            counts.conn_closes += reportbuf[n][3];
-            counts.http_successes += reportbuf[n][4];
-            counts.http_errors += reportbuf[n][5];
+    event_set(&doneev, donefds[0], EV_READ | EV_PERSIST, donecb, nil);
+    event_add(&doneev, nil);
 
-            for(i=0; i<params.nbuckets; i++)
-                counts.counters[i] += reportbuf[n][i + num_cols];
+    if(params.agentfd >= 0)
+        agentlisten();
 
-            /* Clear it. Advance nreport. */
-            memset(reportbuf[n], 0,(params.nbuckets + num_cols) * sizeof(int));
-            nreportbuf[n] = 0;
-            nreport++;
-        }
+    event_dispatch();
 
-        free(line);
+    for(i=0; i<nworkers; i++){
+        if(params.threads)
+            pthread_join(workers[i].thread, nil);
+        else
+            waitpid(workers[i].pid, &status, 0);
     }
 
-    bufferevent_enable(b, EV_READ);
+    report();
 }
 
 void
-chlderrcb(struct bufferevent *b, short what, void *arg)
+sigint(int which)
 {
-    bufferevent_setcb(b, nil, nil, nil, nil);
-    bufferevent_disable(b, EV_READ | EV_WRITE);
-    bufferevent_free(b);
+    /*
+        The first interrupt stops the workers, who write out what
+        they have; the last report follows as they finish. A second
+        one does not wait for them.
+    */
+    if(!stopping){
+        stopworkers();
+        return;
+    }
+    report();
+    exit(0);
 }
 
 void
-parentd(int nprocs, int *sockets)
+printcount(const char *name, uint64_t total, uint64_t count)
 {
-    int *fdp, i, status;
-    struct bufferevent *b;
-
-    signal(SIGINT, sigint);
+    fprintf(stderr, "# %s", name);
+    if(total > 0)
+        fprintf(stderr, "\t%" PRIu64 "\t%.05f", count,(1.0f*count) /(1.0f*total));
 
-    gettimeofday(&ratetv, nil);
-    gettimeofday(&lastreporttv, nil);
-    memset(nreportbuf, 0, sizeof(nreportbuf));
-    for(i=0; i<NBUFFER; i++){
-        if((reportbuf[i] = calloc(params.nbuckets + num_cols, sizeof(int))) == nil)
-            panic("calloc");
-    }
+    fprintf(stderr, "\n");
+}
 
-    event_init();
+void
+printpct(const char *name, uint64_t usec)
+{
+    fprintf(stderr, "# %s\t%.3f\n", name, usec/1000.0);
+}
 
-    for(fdp=sockets; *fdp!=-1; fdp++){
-        b = bufferevent_new(
-            *fdp, chldreadcb, nil,
-            chlderrcb,(void *)&nprocs);
-        bufferevent_enable(b, EV_READ);
-    }
+/* a row of a latency table */
+void
+printhist(char *name, Hist *h)
+{
+    int k;
 
-    event_dispatch();
+    fprintf(stderr, "# %s\t%" PRIu64 "\t%.3f\t", name, h->total, histmean(h)/1000.0);
+    for(k=0; k<NPCTS; k++)
+        fprintf(stderr, "%.3f\t", histpct(h, pcts[k])/1000.0);
+    fprintf(stderr, "%.3f\n", histmax(h)/1000.0);
+}
 
-    for(i=0; i<nprocs; i++)
-        waitpid(0, &status, 0);
+/*
+    Successes by phase: how long until the connection was up, for
+    the requests that waited for one; until the first byte of the
+    response; and until the last. With -e, the handshakes, by
+    connection rather than by request.
+*/
+void
+reportphases()
+{
+    int k;
+
+    fprintf(stderr, "# phase\tcount\tmean\t");
+    for(k=0; k<NPCTS; k++)
+        fprintf(stderr, "p%g\t", pcts[k]);
+    fprintf(stderr, "max\n");
+
+    printhist("connect", &counts.phase[Pconnect]);
+    printhist("ttfb", &counts.phase[Pttfb]);
+    printhist("total", &counts.hist);
+    if(params.tls){
+        printhist("tls_full", &counts.phase[Pfull]);
+        printhist("tls_resumed", &counts.phase[Presumed]);
+    }
+}
 
-    report();
+/*
+    Bytes each way, as a rate over the run, and the sizes of
+    responses to successful requests.
+*/
+void
+reportsizes()
+{
+    struct counters *c = &counts.c;
+    uint64_t usec;
+    Hist *h = &counts.size;
+    int k;
+
+    usec = clknow() - runstart;
+    fprintf(stderr, "# bytes_sent    \t%" PRIu64 "\t%.3f\n", c->bytes_sent, gbps(c->bytes_sent, usec));
+    fprintf(stderr, "# bytes_recvd   \t%" PRIu64 "\t%.3f\n", c->bytes_recvd, gbps(c->bytes_recvd, usec));
+
+    fprintf(stderr, "# size\tcount\tmean\t");
+    for(k=0; k<NPCTS; k++)
+        fprintf(stderr, "p%g\t", pcts[k]);
+    fprintf(stderr, "max\n");
+    fprintf(stderr, "# bytes\t%" PRIu64 "\t%.0f\t", h->total, histmean(h));
+    for(k=0; k<NPCTS; k++)
+        fprintf(stderr, "%" PRIu64 "\t", histpct(h, pcts[k]));
+    fprintf(stderr, "%" PRIu64 "\n", histmax(h));
 }
 
+/* latency by template, merged across workers */
 void
-sigint(int which)
+reporttmpls()
 {
-    report();
-    exit(0);
+    Hist h, snap;
+    int i, j, k;
+
+    fprintf(stderr, "# tmpl\tweight\tcount\tmean\t");
+    for(k=0; k<NPCTS; k++)
+        fprintf(stderr, "p%g\t", pcts[k]);
+    fprintf(stderr, "max\trequest\n");
+
+    for(i=0; i<ntmpls; i++){
+        histreset(&h);
+        for(j=0; j<nworkers; j++){
+            histsnap(&snap, &workers[j].thist[i]);
+            if(workers[j].warmthist != nil)
+                histdelta(&h, &snap, &workers[j].warmthist[i]);
+            else
+                histmerge(&h, &snap);
+        }
+        fprintf(stderr, "# %d\t%g\t%" PRIu64 "\t%.3f\t", i, tmpls[i].weight, h.total, histmean(&h)/1000.0);
+        for(k=0; k<NPCTS; k++)
+            fprintf(stderr, "%.3f\t", histpct(&h, pcts[k])/1000.0);
+        fprintf(stderr, "%.3f\t%s %s\n", histmax(&h)/1000.0, tmpls[i].method, tmpls[i].path);
+    }
 }
 
+/*
+    How evenly the work was spread, to show up bad placement: each
+    worker's rate, and how far the slowest fell short of the fastest.
+*/
 void
-printcount(const char *name, int total, int count)
+reportworkers()
 {
-    fprintf(stderr, "# %s", name);
-    if(total > 0)
-        fprintf(stderr, "\t%d\t%.05f", count,(1.0f*count) /(1.0f*total));
+    char where[32];
+    uint64_t n, start, end;
+    double hz, minhz, maxhz;
+    worker *w;
+    int i;
 
-    fprintf(stderr, "\n");
+    minhz = HUGE_VAL;
+    maxhz = 0;
+    for(i=0; i<nworkers; i++){
+        w = &workers[i];
+        n = w->stats->c.conn_successes - w->warmn;
+        // each over its own run, less the warmup: one finishing early was faster
+        if((end = w->stats->end) == 0)
+            end = clknow();
+        start = w->stats->start > runstart ? w->stats->start : runstart;
+        hz = end > start ? n * 1e6 / (end - start) : 0;
+        if(w->cpu >= 0)
+            snprintf(where, sizeof(where), "cpu %d", w->cpu);
+        else if(w->node >= 0)
+            snprintf(where, sizeof(where), "node %d", w->node);
+        else
+            snprintf(where, sizeof(where), "-");
+        fprintf(stderr, "# worker %-6d\t%s\t%" PRIu64 "\t%.0f\n", i, where, n, hz);
+        if(hz < minhz)
+            minhz = hz;
+        if(hz > maxhz)
+            maxhz = hz;
+    }
+    if(maxhz > 0)
+        fprintf(stderr, "# worker_spread\t\t%.5f\n", (maxhz - minhz) / maxhz);
 }
 
 void
 report()
 {
     char buf[128];
-    int i, total = counts.conn_successes + counts.conn_errors + counts.conn_timeouts;
+    struct counters *c = &counts.c;
+    int i;
+    uint64_t total = c->conn_successes + c->conn_errors + c->conn_timeouts;
 
-    fprintf(stderr, "# hz\t\t\t%ld\n", mkrate(&ratetv, total));
-    fprintf(stderr, "# time\t\t\t%.3f\n", milliseconds_since_start(&ratetv)/1000.0);
+    if(warm.on)
+        fprintf(stderr, "# warmup: not over; the summary includes it\n");
+    fprintf(stderr, "# hz\t\t\t%ld\n", mkrate(runstart, total));
+    fprintf(stderr, "# time\t\t\t%.3f\n", milliseconds_since_start(runstart)/1000.0);
+    if(rpc_enabled())
+        fprintf(stderr, "# conn_hz\t\t%ld\n", mkrate(runstart, c->conn_opens));
 
     printcount("conn_total    ", total, total);
-    printcount("conn_successes", total, counts.conn_successes);
-    printcount("conn_errors   ", total, counts.conn_errors);
-    printcount("conn_timeouts ", total, counts.conn_timeouts);
-    printcount("conn_closes   ", total, counts.conn_closes);
-    printcount("http_successes", total, counts.http_successes);
-    printcount("http_errors   ", total, counts.http_errors);
+    printcount("conn_successes", total, c->conn_successes);
+    printcount("conn_errors   ", total, c->conn_errors);
+    printcount("conn_timeouts ", total, c->conn_timeouts);
+    printcount("conn_opens    ", total, c->conn_opens);
+    printcount("conn_closes   ", total, c->conn_closes);
+    printcount("http_successes", total, c->http_successes);
+    printcount("http_errors   ", total, c->http_errors);
+    if(params.checksum)
+        printcount("body_errors   ", total, c->body_errors);
+    if(openloop_enabled())
+        printcount("late          ", total, c->late);
     for(i=0; params.buckets[i]!=0; i++){
         snprintf(buf, sizeof(buf), "<%d\t\t", params.buckets[i]);
-        printcount(buf, total, counts.counters[i]);
+        printcount(buf, total, c->counters[i]);
     }
 
     snprintf(buf, sizeof(buf), ">=%d\t\t", params.buckets[i - 1]);
-    printcount(buf, total, counts.counters[i]);
+    printcount(buf, total, c->counters[i]);
+
+    printpct("mean_ms       ", histmean(&counts.hist));
+    for(i=0; i<NPCTS; i++){
+        snprintf(buf, sizeof(buf), "p%-13g", pcts[i]);
+        printpct(buf, histpct(&counts.hist, pcts[i]));
+    }
+    printpct("max_ms        ", histmax(&counts.hist));
+
+    reportphases();
+    reportsizes();
+    if(ntmpls > 1)
+        reporttmpls();
+    if(nworkers > 1)
+        reportworkers();
+    heatdone();
 }
 
 /*
     Main, dispatch.
 */
 
+/* LIST[:AGG] for -A and -N: the workers' list, and the aggregator's */
+int
+placearg(char *arg, int **v, int *agg)
+{
+    char *p;
+    int *a;
+
+    *agg = -1;
+    if((p = strchr(arg, ':')) != nil){
+        *p++ = '\0';
+        if(parselist(p, &a) != 1)
+            return -1;
+        *agg = a[0];
+        free(a);
+    }
+    return parselist(arg, v);
+}
+
+/* the column headings for printinterval */
+void
+header()
+{
+    int i;
+
+    fprintf(stderr, "# \t\tconn\tconn\tconn\tconn\thttp\thttp\n");
+    fprintf(stderr, "# ts\t\tsuccess\terrors\ttimeout\tcloses\tsuccess\terror\t");
+    for(i=0; params.buckets[i]!=0; i++)
+        fprintf(stderr, "<%d\t", params.buckets[i]);
+
+    fprintf(stderr, ">=%d\thz", params.buckets[i - 1]);
+    for(i=0; i<NPCTS; i++)
+        fprintf(stderr, "\tp%g", pcts[i]);
+    fprintf(stderr, "\ttxGb/s\trxGb/s");
+    if(openloop_enabled())
+        fprintf(stderr, "\tlate");
+    fprintf(stderr, "\n");
+}
+
 void
 usage(char *cmd)
 {
     fprintf(
         stderr,
-        "%s: [-c CONCURRENCY] [-b BUCKETS] [-n COUNT] [-p NUMPROCS]\n"
-        "[-r RPC] [-i INTERVAL] [-o TSV RECORD] [-l MAX_QPS]\n"
-        "[-u PATH] [-H HOST_HDR] [HOST] [PORT]\n",
+        "%s: [-c CONCURRENCY] [-b BUCKETS] [-n COUNT] [-p NUMPROCS] [-T]\n"
+        "[-r RPC] [-K] [-B SOURCES] [-e RESUME] [-P DEPTH] [-t TIMEOUT] [-i INTERVAL]\n"
+        "[-o TSV RECORD] [-O TRACE] [-l MAX_QPS] [-w WARMUP] [-R RATE] [-S SLO]\n"
+        "[-a const|poisson] [-E evhttp|raw|uring|h2] [-k mono|tsc] [-A CPUS[:CPU]] [-N NODES[:NODE]]\n"
+        "[-u PATH] [-m METHOD] [-d BODY] [-f TEMPLATES] [-H HOST_HDR] [-s] [-x]\n"
+        "[-M [ADDR:]PORT] [-G HEATMAP] [-C AGENTS] [HOST|SOCKET] [PORT]\n"
+        "%s: -L [ADDR:]PORT\n",
+        cmd,
         cmd);
 
     exit(0);
@@ -567,13 +1889,21 @@ usage(char *cmd)
 int
 main(int argc, char **argv)
 {
-    int ch, i, nprocs = 1, is_parent = 1, port, *sockets, fds[2];
-    pid_t pid;
+    int ch, i, port;
     char *sp, *ap, *host, *cmd = argv[0];
+    struct stats *stats;
+    Hist *thists = nil;
+    char what[2048], tlsparam[32];
 
     /* Defaults */
     params.count = -1;
     params.rpc = -1;
+    params.depth = 1;
+    params.timeout = 1000;
+    params.aggcpu = -1;
+    params.aggnode = -1;
+    params.agentfd = -1;
+    params.nagents = 1;
     params.concurrency = 1;
     memset(params.buckets, 0, sizeof(params.buckets));
     params.buckets[0] = 1;
@@ -582,12 +1912,13 @@ main(int argc, char **argv)
     params.nbuckets = 4;
     params.path = "/";
     params.host_hdr = 0;
+    nworkers = 1;
 
     memset(&counts, 0, sizeof(counts));
 
     signal(SIGPIPE, SIG_IGN);
 
-    while((ch = getopt(argc, argv, "c:l:b:n:p:r:i:u:o:H:h")) != -1){
+    while((ch = getopt(argc, argv, OPTS)) != -1){
         switch(ch){
         case 'b':
             sp = optarg;
@@ -617,7 +1948,63 @@ main(int argc, char **argv)
             break;
 
         case 'p':
-            nprocs = atoi(optarg);
+            nworkers = atoi(optarg);
+            break;
+
+        case 'T':
+            params.threads = 1;
+            break;
+
+        case 'K':
+            params.churn = 1;
+            break;
+
+        case 'e':
+            params.tls = 1;
+            params.resume = atof(optarg);
+            if(params.resume < 0 || params.resume > 100)
+                panic("Invalid arguments: -e (RESUME) is a percentage.");
+            break;
+
+        case 'B':
+            params.sources = optarg;
+            if((params.nsrcs = srcparse(optarg)) == 0)
+                panic("Invalid arguments: -B (SOURCES) wants addresses or prefixes of one family, comma-separated.");
+            break;
+
+        case 's':
+            params.stream = 1;
+            break;
+
+        case 'C':
+            params.agents = optarg;
+            break;
+
+        case 'M':
+            params.metrics = optarg;
+            break;
+
+        case 'G':
+            heatfile(optarg);
+            break;
+
+        case 'L':
+            agentd(optarg);
+            break;
+
+        case 'J':
+            if(sscanf(optarg, "%d,%d,%d,%" SCNu64, &params.agentfd, &params.agentidx,
+                    &params.nagents, &params.startwall) != 4 || params.nagents < 1)
+                panic("Invalid arguments: -J is for agents.");
+            break;
+
+        case 'x':
+            params.stream = 1;
+            params.checksum = 1;
+            break;
+
+        case 't':
+            params.timeout = atoi(optarg);
             break;
 
         case 'i':
@@ -628,10 +2015,36 @@ main(int argc, char **argv)
             params.rpc = atoi(optarg);
             break;
 
+        case 'P':
+            params.depth = atoi(optarg);
+            break;
+
         case 'l':
             params.qps = atoi(optarg);
             break;
 
+        case 'R':
+            params.rate = atof(optarg);
+            break;
+
+        case 'S':
+            params.slo = optarg;
+            parseslo(optarg);
+            break;
+
+        case 'w':
+            parsewarm(optarg);
+            break;
+
+        case 'a':
+            if(strcmp(optarg, "poisson") == 0)
+                params.poisson = 1;
+            else if(strcmp(optarg, "const") == 0)
+                params.poisson = 0;
+            else
+                panic("Invalid arguments: -a takes const or poisson.");
+            break;
+
         case 'o':
             params.tsvout = optarg;
             params.tsvoutfile = fopen(params.tsvout, "w+");
@@ -640,14 +2053,64 @@ main(int argc, char **argv)
                 panic("Could not open TSV outputfile: %s", optarg);
             break;
 
+        case 'O':
+            params.traceout = optarg;
+            break;
+
         case 'u':
             params.path = optarg;
             break;
 
+        case 'f':
+            params.tmplfile = optarg;
+            break;
+
+        case 'm':
+            params.method = optarg;
+            break;
+
+        case 'd':
+            params.bodyfile = optarg;
+            break;
+
         case 'H':
             params.host_hdr = optarg;
             break;
 
+        case 'E':
+            if(strcmp(optarg, "evhttp") == 0)
+                engine = &evhttpengine;
+            else if(strcmp(optarg, "raw") == 0)
+                engine = &rawengine;
+            else if(strcmp(optarg, "uring") == 0)
+                engine = &uringengine;
+            else if(strcmp(optarg, "h2") == 0)
+                engine = &h2engine;
+            else
+                panic("Invalid arguments: unknown engine \"%s\".", optarg);
+            break;
+
+        case 'k':
+            if(strcmp(optarg, "tsc") == 0)
+                params.tsc = 1;
+            else if(strcmp(optarg, "mono") == 0)
+                params.tsc = 0;
+            else
+                panic("Invalid arguments: -k takes mono or tsc.");
+            break;
+
+        case 'A':
+            params.placement = strdup(optarg);
+            if((params.ncpus = placearg(optarg, &params.cpus, &params.aggcpu)) < 0)
+                panic("Invalid arguments: -A takes a CPU list, like 0-3,8.");
+            break;
+
+        case 'N':
+            params.placement = strdup(optarg);
+            if((params.nnodes = placearg(optarg, &params.nodes, &params.aggnode)) < 0)
+                panic("Invalid arguments: -N takes a NUMA node list, like 0,1.");
+            break;
+
         case 'h':
             usage(cmd);
             break;
@@ -671,15 +2134,100 @@ main(int argc, char **argv)
         panic("Invalid arguments: couldn't understand host and port.");
     }
 
+    if(nworkers < 1)
+      panic("Invalid arguments: -p (NUMPROCS) must be at least 1.");
+
+    if(params.count >= 0 && params.warmn >= params.count)
+      panic("Invalid arguments: -w (WARMUP) would take all of -n (COUNT).");
+    warm.on = params.warmup != nil;
+
+    // the agents check the rest of the arguments for themselves
+    if(params.agents != nil){
+        if(params.slo != nil)
+            panic("Invalid arguments: -S (SLO) does not support -C (AGENTS).");
+        if(params.tsvout != nil || params.traceout != nil)
+            panic("Invalid arguments: agents write no files; -C (AGENTS) takes no -o or -O.");
+        nworkers = 0;   // the agents have them
+        controller(params.agents, argv - optind, argc + optind);
+    }
+
+    if(params.ncpus > 0 && params.nnodes > 0)
+      panic("Invalid arguments: -A (CPUS) and -N (NODES) are exclusive.");
+
+    for(i=0; i<params.ncpus; i++)
+        if(!cpuok(params.cpus[i]))
+            panic("Invalid arguments: -A: cannot run on CPU %d.", params.cpus[i]);
+    if(params.aggcpu >= 0 && !cpuok(params.aggcpu))
+        panic("Invalid arguments: -A: cannot run on CPU %d.", params.aggcpu);
+
+    for(i=0; i<params.nnodes; i++)
+        if(!nodeok(params.nodes[i]))
+            panic("Invalid arguments: -N: no NUMA node %d.", params.nodes[i]);
+    if(params.aggnode >= 0 && !nodeok(params.aggnode))
+        panic("Invalid arguments: -N: no NUMA node %d.", params.aggnode);
+
+    if(params.timeout < 1)
+      panic("Invalid arguments: -t (TIMEOUT) must be at least 1.");
+
+    if(params.depth < 1)
+      panic("Invalid arguments: -P (DEPTH) must be at least 1.");
+
+    // a host with a slash in it is the path of a Unix domain socket
+    http_unix = strchr(host, '/') != nil;
+    if(http_unix){
+        // libevent's HTTP client only ever connects by name and port
+        if(engine == &evhttpengine){
+            fprintf(stderr, "# evhttp cannot connect to a Unix socket, using -E raw\n");
+            engine = &rawengine;
+        }
+        if(params.sources != nil)
+            panic("Invalid arguments: -B (SOURCES) does not support a Unix socket.");
+    }
+
+    // evhttp queues requests on a connection but never pipelines them
+    if(params.depth > 1 && engine == &evhttpengine)
+      panic("Invalid arguments: -P (DEPTH) needs -E raw, uring or h2.");
+
+    if(params.tls && engine != &evhttpengine && engine != &rawengine)
+      panic("Invalid arguments: -e (TLS) needs -E raw or evhttp.");
+
+    // churn is -r 1, with nothing else on the connection
+    if(params.churn){
+        if(params.depth > 1)
+            panic("Invalid arguments: -K (churn) sends one request per connection; no -P.");
+        if(qps_enabled())
+            panic("Invalid arguments: -l (MAX_QPS) does not support -K (churn).");
+        params.rpc = 1;
+    }
+
     if(qps_enabled() && rpc_enabled())
       panic("Invalid arguments: -l (MAX_QPS) does not support -r (RPC).");
 
+    // the search starts from -R, or from a rate anything can take
+    if(params.slo != nil){
+        if(params.count >= 0 || qps_enabled())
+            panic("Invalid arguments: -S (SLO) decides when to stop; it takes no -n or -l.");
+        if(params.warmup != nil)
+            panic("Invalid arguments: -S (SLO) leaves out the start of each step; it takes no -w.");
+        if(!openloop_enabled())
+            params.rate = 100;
+    }
+
+    if(qps_enabled() && openloop_enabled())
+      panic("Invalid arguments: -l (MAX_QPS) and -R (RATE) are exclusive.");
+
+    // -l fires whether or not the last request came back; raw runners hold one
+    if(qps_enabled() && engine != &evhttpengine)
+      panic("Invalid arguments: -l (MAX_QPS) needs -E evhttp; use -R (RATE).");
+
     http_hostname = host;
     http_port = port;
 
     if (params.host_hdr != 0) {
         if(snprintf(http_hosthdr, sizeof(http_hosthdr), "%s", params.host_hdr) > sizeof(http_hosthdr))
             panic("snprintf");
+    } else if(http_unix) {
+        strcpy(http_hosthdr, "localhost");
     } else {
         if(snprintf(http_hosthdr, sizeof(http_hosthdr), "%s:%d", host, port) > sizeof(http_hosthdr))
             panic("snprintf");
@@ -687,79 +2235,97 @@ main(int argc, char **argv)
 
     fprintf(stderr, "# Host: %s\n", http_hosthdr);
 
-    for(i = 0; params.buckets[i] != 0; i++)
-        request_timeout = params.buckets[i];
+    // before any workers, which share the calibration
+    if(!clkinit(params.tsc)){
+        fprintf(stderr, "# TSC not invariant, using -k mono\n");
+        params.tsc = 0;
+    }
 
+    if(engine->init != nil)
+        engine->init();
+    if(params.tls)
+        tlsinit();
+    if(params.nsrcs > 0)
+        checksrcs();
+
+    mktmpls(params.tmplfile);
+    if(params.tmplfile != nil)
+        snprintf(what, sizeof(what), "-f %s", params.tmplfile);
+    else
+        snprintf(what, sizeof(what), "-m %s -u %s%s%s", tmpls[0].method, params.path,
+            params.bodyfile != nil ? " -d " : "", params.bodyfile != nil ? params.bodyfile : "");
+
+    snprintf(tlsparam, sizeof(tlsparam), " -e %g", params.resume);
     // FIXME Should also show bucket parameters
-    fprintf(stderr, "# params: -c %d -n %d -p %d -r %d -i %d -l %d -u %s %s %d\n",
-        params.concurrency, params.count, nprocs, params.rpc, (int) reporttv.tv_sec, params.qps, params.path, http_hostname, http_port);
+    fprintf(stderr, "# params: -c %d -n %d -p %d%s -r %d%s%s%s%s -P %d -t %d -i %d%s%s -l %d -R %g%s%s -a %s -E %s%s -k %s%s%s %s %s %d\n",
+        params.concurrency, params.count, nworkers, params.threads ? " -T" : "",
+        params.rpc, params.churn ? " -K" : "",
+        params.sources != nil ? " -B " : "", params.sources != nil ? params.sources : "",
+        params.tls ? tlsparam : "",
+        params.depth, params.timeout, (int) reporttv.tv_sec,
+        params.warmup != nil ? " -w " : "", params.warmup != nil ? params.warmup : "", params.qps,
+        params.rate, params.slo != nil ? " -S " : "", params.slo != nil ? params.slo : "",
+        params.poisson ? "poisson" : "const", engine->name,
+        params.checksum ? " -x" : params.stream ? " -s" : "",
+        params.tsc ? "tsc" : "mono",
+        params.ncpus > 0 ? " -A " : params.nnodes > 0 ? " -N " : "",
+        params.placement != nil ? params.placement : "",
+        what, http_hostname, http_port);
 
     // Convert absolute params to be relative to concurrency
-    params.count /= nprocs;
+    if(params.count > 0)
+        params.count /= params.nagents * nworkers;
+    params.warmn /= params.nagents;
 
-    params.qps /= nprocs;
+    params.qps /= params.nagents * nworkers;
     params.qps /= params.concurrency;
 
-    fprintf(stderr, "# \t\tconn\tconn\tconn\tconn\thttp\thttp\n");
-    fprintf(stderr, "# ts\t\tsuccess\terrors\ttimeout\tcloses\tsuccess\terror\t");
-    for(i=0; params.buckets[i]!=0; i++)
-        fprintf(stderr, "<%d\t", params.buckets[i]);
-
-    fprintf(stderr, ">=%d\thz\n", params.buckets[i - 1]);
-
-    if((sockets = calloc(nprocs + 1, sizeof(int))) == nil)
-        panic("malloc\n");
-
-    sockets[nprocs] = -1;
-
-    for(i=0; i<nprocs; i++){
-        if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0){
-            perror("socketpair");
-            exit(1);
-        }
-
-        sockets[i] = fds[0];
-
-        if((pid = fork()) < 0){
-            kill(0, SIGINT);
-            perror("fork");
-            exit(1);
-        }else if(pid != 0){
-            close(fds[1]);
-            continue;
-        }
-
-        is_parent = 0;
+    params.rate /= params.nagents * nworkers;
 
-        event_init();
+    ctl = mmap(nil, sizeof(*ctl), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(ctl == MAP_FAILED)
+        panic("mmap");
+    ctl->rate = params.rate;
+    ctl->warm = !warm.on;
+    search.rate = params.rate * nworkers;
 
-        /* Set up output. */
-        if(dup2(fds[1], STDOUT_FILENO) < 0){
-            perror("dup2");
-            exit(1);
-        }
+    header();
 
-        close(fds[1]);
+    if((workers = calloc(nworkers, sizeof(worker))) == nil)
+        panic("calloc");
 
-        // create a buffer for this process
-        if(tsv_enabled()) {
-            char *out = mal(sizeof(char) * OUTFILE_BUFFER_SIZE);
-            setvbuf(params.tsvoutfile, out, _IOLBF, OUTFILE_BUFFER_SIZE);
-        }
+    if(pipe(donefds) < 0 || pipe(stopfds) < 0)
+        panic("pipe");
 
-        for(i=0; i<params.concurrency; i++)
-            mkrunner();
+    /* shared with forked workers; page aligned, hence cache-line aligned */
+    stats = mmap(nil, nworkers * sizeof(struct stats), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(stats == MAP_FAILED)
+        panic("mmap");
 
-        /* event handler for reports */
-        evtimer_set(&reportev, reportcb, nil);
-        evtimer_add(&reportev, &reporttv);
-        event_dispatch();
+    if(ntmpls > 1){
+        thists = mmap(nil, nworkers * ntmpls * sizeof(Hist), PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if(thists == MAP_FAILED)
+            panic("mmap");
+    }
 
-        break;
+    // an agent's run starts when the controller said, with the others
+    if(params.agentfd >= 0)
+        agentwait();
+
+    for(i=0; i<nworkers; i++){
+        workers[i].id = i;
+        workers[i].srcnext = i;
+        workers[i].stats = &stats[i];
+        if(thists != nil)
+            workers[i].thist = &thists[i * ntmpls];
+        workers[i].cpu = params.ncpus > 0 ? params.cpus[i % params.ncpus] : -1;
+        workers[i].node = params.nnodes > 0 ? params.nodes[i % params.nnodes] : -1;
+        startworker(&workers[i]);
     }
 
-    if(is_parent)
-        parentd(nprocs, sockets);
+    parentd();
 
     return(0);
 }
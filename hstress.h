@@ -0,0 +1,362 @@
+/*
+	Shared between hstress.c and its engines.
+
+	Callers include <stdio.h>, <stdint.h>, <pthread.h>, <event.h>,
+	<evhttp.h> and hist.h first.
+*/
+
+#define MAX_BUCKETS 100
+
+/* hstress's options, for getopt; agents check runs against them */
+#define OPTS "c:l:b:n:p:r:P:t:i:u:f:m:d:o:O:H:R:S:a:E:k:A:N:C:L:J:M:G:B:e:w:sxKTh"
+
+/* how many percentiles there are in pcts */
+#define NPCTS 4
+
+/*
+    Worker counters have a single writer and are read concurrently
+    by the aggregator, so a relaxed store is all an increment needs.
+*/
+#define bump(x) __atomic_store_n(&(x), (x) + 1, __ATOMIC_RELAXED)
+#define add(x, n) __atomic_store_n(&(x), (x) + (n), __ATOMIC_RELAXED)
+
+/* FNV-1a, over response bodies with -x */
+#define SUMINIT 0xcbf29ce484222325ULL
+
+struct params{
+    int count;
+    int concurrency;
+    int buckets[MAX_BUCKETS];
+    int nbuckets;
+    int rpc;
+    int qps;
+
+    // requests kept in flight on each connection
+    int depth;
+
+    // give up on a request after this many milliseconds
+    int timeout;
+
+    // -K: a new connection for every request, closed by reset
+    // -B: local addresses to connect from, in turn
+    int churn;
+    char *sources;
+    uint64_t nsrcs;
+
+    // -e: TLS, resuming the last session this percent of the time
+    int tls;
+    double resume;
+
+    // open-loop arrival rate (per worker, after setup) and distribution
+    double rate;
+    int poisson;
+
+    // -S: search for the highest rate that meets an SLO
+    char *slo;
+
+    // -w: leave out of the summary the first warmn requests, the
+    // first warmusec, or with warmauto, until the run is steady
+    char *warmup;
+    uint64_t warmn;
+    uint64_t warmusec;
+    int warmauto;
+
+    // run workers as threads rather than processes
+    int threads;
+
+    // -A: CPUs to pin workers to in turn, and the aggregator's
+    // -N: the same with NUMA nodes; -1 for none
+    char *placement;
+    int *cpus;
+    int ncpus;
+    int aggcpu;
+    int *nodes;
+    int nnodes;
+    int aggnode;
+
+    // time with the TSC rather than CLOCK_MONOTONIC
+    int tsc;
+
+    // -s: read evhttp response bodies as they come rather than whole
+    // -x: and check that each template's are all the same
+    int stream;
+    int checksum;
+
+    // for logging output time
+    char *tsvout;
+    FILE *tsvoutfile;
+
+    // binary trace files are this plus .N for each worker
+    char *traceout;
+
+    // -M: serve metrics on [addr:]port
+    char *metrics;
+
+    // -C: agents to run on, host:port,...
+    // -L runs an agent, which runs hstress -J with the controller's
+    // arguments: intervals go to agentfd, from a share of the load
+    // starting at startwall (epoch microseconds)
+    char *agents;
+    int agentfd;
+    int agentidx;
+    int nagents;
+    uint64_t startwall;
+
+    // request templates, or failing that the method, path and body
+    char *tmplfile;
+    char *method;
+    char *path;
+    char *bodyfile;
+    char *host_hdr;
+};
+
+/*
+    Cumulative counts for a worker. Nothing but uint64_t may go in
+    here: aggregation walks it as an array of NCOUNTERS of them.
+*/
+struct counters{
+    uint64_t conns;
+    uint64_t conn_successes;
+    uint64_t conn_errors;
+    uint64_t conn_timeouts;
+    uint64_t conn_closes;
+    uint64_t conn_opens;
+    uint64_t http_successes;
+    uint64_t http_errors;
+    uint64_t late;
+    uint64_t body_errors;
+    uint64_t bytes_sent;
+    uint64_t bytes_recvd;
+    uint64_t counters[MAX_BUCKETS + 1];
+};
+#define NCOUNTERS (sizeof(struct counters)/sizeof(uint64_t))
+
+/*
+    Phases of a request, each timed from when it was sent; and with
+    -e the TLS handshakes, timed from when TCP was up, once for each
+    connection whatever became of its requests.
+*/
+enum{
+    Pconnect,       /* until its connection was up, if it waited for one */
+    Pttfb,          /* until the first byte of the response */
+    Pfull,          /* a full handshake */
+    Presumed,       /* a resumed one */
+    Nphase
+};
+
+/*
+    Everything a worker reports. Each worker's stats start on their
+    own cache line so that workers never share one.
+*/
+struct stats{
+    struct counters c;
+    Hist            hist;
+    Hist            phase[Nphase];  /* 200s only, like hist; but see above */
+    Hist            size;           /* of 200s, in bytes */
+    uint64_t        start;          /* clk, when the worker began */
+    uint64_t        end;            /* and finished */
+    int             done;
+} __attribute__((aligned(64)));
+
+typedef struct runner runner;
+
+/* a request to send; see tmpl.c */
+struct tmpl{
+    char            *method;
+    char            *path;
+    char            **keys;         /* headers */
+    char            **vals;
+    int             nhdrs;
+    int             hashost;
+    double          weight;
+    int             evcmd;          /* enum evhttp_cmd_type, or -1 */
+    int             nobody;         /* HEAD: responses have no body */
+    int             haslen;         /* has its own Content-Length */
+    char            *body;          /* mapped from a file, or nil */
+    size_t          bodylen;
+    char            *raw;           /* serialized, for -E raw; a HEADERS frame for -E h2 */
+    int             rawlen;
+};
+
+struct request{
+    runner                   *run;
+    struct request           *next;         /* on the worker's free list */
+    uint64_t                 start;         /* clk microseconds */
+    uint64_t                 first;         /* first byte of the response, or 0 */
+    uint64_t                 sum;           /* of the response body so far, with -x */
+    uint64_t                 size;          /* of the response, head and body */
+    int                      waited;        /* sent before its connection was up */
+    int                      conngen;       /* run->conngen when sent */
+    int                      tmpl;          /* index in tmpls */
+    Wentry                   timeout;
+    struct event             dispatchev;
+    int                      sock;
+    struct evhttp_connection *evcon;
+    int                      evgen;         /* run->evgen when sent */
+    struct evhttp_request    *evreq;
+    int                      evcon_reqno;
+    int                      status;        /* HTTP status, or -1 */
+};
+
+typedef struct worker worker;
+
+struct runner{
+    struct timeval            tv;
+    struct event              ev;
+    struct evhttp_connection *evcon;
+    int                       evgen;        /* bumped for each new evcon */
+    struct conn               *conn;        /* raw engine */
+    struct h2conn             *h2;          /* h2 engine */
+    struct event              connev;       /* evhttp: the connect finishing */
+    char                      *drain;       /* evhttp: response bodies pass through, with -s */
+    uint64_t                  connat;       /* clk when connected, 0 while connecting */
+    int                       conngen;      /* bumped for each connect */
+    int                       tlsgen;       /* conngen, once its handshake is timed */
+    struct ssl_session_st     *tlssess;     /* -e: the last session, to resume */
+    struct request            *req;         /* the last one sent */
+    worker                    *w;
+    int                       reqno;        /* sent on this connection */
+    int                       inflight;
+    int                       idle;         /* on the open-loop idle list */
+    int                       retired;
+    int                       id;
+};
+
+/* open-loop arrival schedule, one per worker */
+struct sched{
+    struct event   ev;
+    double         next;        /* intended time of the next arrival, usec */
+    double         rate;        /* arrivals a second */
+    int            gen;         /* ctl->gen, when rate was set */
+    int            done;
+    unsigned short xsubi[3];
+
+    /* runners with room for another request */
+    runner         **idle;
+    int            nidle;
+
+    /* intended times of arrivals still waiting for a runner */
+    double         *backlog;
+    int            backloghead;
+    int            nbacklog;
+    int            backlogsz;
+};
+
+/*
+    Written by the aggregator, read by workers: the open-loop rate
+    for each worker, and a count bumped each time it is changed.
+*/
+struct ctl{
+    double          rate;
+    int             gen;
+    int             warm;           /* the warmup is over: -o and -O record */
+};
+
+/*
+    A worker is one event loop driving params.concurrency runners,
+    either in a forked process or in a thread of its own.
+*/
+struct worker{
+    int                 id;
+    struct event_base   *base;
+    struct stats        *stats;
+    int                 concurrency;    /* runners not yet retired */
+    int                 runid;
+    runner              *runners;
+    struct request      *freereqs;
+    struct sched        sched;
+    struct Uring        *uring;         /* -E uring */
+    struct Trace        *trace;         /* -O */
+    struct Wheel        *timeouts;
+    int                 cpu;            /* -A, or -1 */
+    int                 node;           /* -N, or -1 */
+    Hist                *thist;         /* per template, with -f */
+    uint64_t            *sums;          /* per template, the first 200's body sum, with -x */
+    uint64_t            srcnext;        /* -B: the next source address */
+    uint64_t            warmn;          /* successes in the warmup, and */
+    Hist                *warmthist;     /* thist as it ended; the aggregator's */
+    unsigned short      xsubi[3];       /* picks templates, and whether to resume */
+    pid_t               pid;
+    pthread_t           thread;
+};
+
+/*
+    An engine puts requests on the wire for a runner. The generic
+    code in hstress.c only ever talks to connections through one.
+    Engines report each finished request through complete(), in
+    the order they were sent on a connection, but for h2, whose
+    streams finish as they will. When a request times out, expire
+    takes down its connection and completes it along with anything
+    sent after it; h2 need only cancel its stream.
+*/
+struct engine{
+    char            *name;
+    void            (*init)(void);          /* once, before workers start */
+    void            (*open)(runner *run);
+    void            (*close)(runner *run);
+    struct request  *(*newreq)(runner *run);
+    void            (*freereq)(runner *run, struct request *req);
+    void            (*send)(runner *run, struct request *req);
+    void            (*expire)(struct request *req);
+};
+
+enum{
+    Success,
+    Closed,
+    Error,
+    Timeout
+};
+
+extern struct params params;
+extern char *http_hostname;
+extern uint16_t http_port;
+extern int http_unix;
+extern char http_hosthdr[2048];
+extern struct engine *engine;
+extern struct engine evhttpengine;
+extern struct engine rawengine;
+extern struct engine uringengine;
+extern struct engine h2engine;
+extern struct tmpl *tmpls;
+extern struct ctl *ctl;
+extern int ntmpls;
+extern struct stats counts;
+extern struct timeval reporttv;
+extern uint64_t runstart;
+extern int stopping;
+extern double pcts[NPCTS];
+
+struct request *reqalloc(worker *w);
+void reqfree(worker *w, struct request *req);
+void complete(int how, struct request *req);
+void connecting(runner *run);
+void connected(runner *run);
+void targetaddr(struct sockaddr_storage *ss, socklen_t *len);
+void bindsrc(worker *w, int fd);
+void churnclose(int fd);
+void tlsinit(void);
+struct ssl_st *tlsnew(runner *run);
+void tlsclose(struct ssl_st *ssl);
+uint64_t bodysum(uint64_t h, char *p, size_t n);
+void merge(struct stats *dst, struct stats *src);
+void warmup(struct stats *st, uint64_t usec);
+void printinterval(int ts, struct stats *st, uint64_t usec);
+void header(void);
+void report(void);
+void stopworkers(void);
+
+void agentd(char *where);
+void agentwait(void);
+void agentlisten(void);
+void agentsend(struct stats *st);
+void agentdone(void);
+void controller(char *agents, char **argv, int argc);
+
+void mkmetrics(struct event_base *base, char *where);
+void metricsnote(struct stats *st, uint64_t usec);
+void metricsdone(void);
+void heatfile(char *path);
+void heatnote(int ts, Hist *h);
+void heatdone(void);
+void mktmpls(char *file);
+int picktmpl(worker *w);
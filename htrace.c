@@ -0,0 +1,48 @@
+/*
+	Decode hstress -O traces to the TSV that -o writes: start and
+	end in microseconds, how the request ended, and the connect and
+	first byte times, in microseconds from the start.
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "u.h"
+#include "trace.h"
+
+static void
+pr(void *arg, uint64_t start, uint64_t end, int how, uint64_t connect, uint64_t ttfb)
+{
+	printf("%llu\t%llu\t%d\t%llu\t%llu\n", (unsigned long long)start, (unsigned long long)end, how,
+		(unsigned long long)connect, (unsigned long long)ttfb);
+}
+
+static void
+decode(FILE *f, char *name)
+{
+	if(tracescan(f, pr, nil) < 0)
+		panic("%s: not a trace, or cut short", name);
+}
+
+int
+main(int argc, char **argv)
+{
+	FILE *f;
+	int i;
+
+	if(argc < 2){
+		decode(stdin, "stdin");
+		return 0;
+	}
+	for(i=1; i<argc; i++){
+		if((f = fopen(argv[i], "r")) == nil)
+			panic("open %s: %s", argv[i], strerror(errno));
+		decode(f, argv[i]);
+		fclose(f);
+	}
+	return 0;
+}
@@ -0,0 +1,207 @@
+/*
+    Live metrics, with -M: the aggregator (or the controller, with
+    -C) serves its numbers over HTTP from its own event loop.
+
+        /metrics    Prometheus text format
+        /json       the same, as JSON
+
+    Both give the counters, bytes and latency percentiles over the
+    run so far and over the last interval. Nothing is done for them
+    between scrapes but keeping a copy of each interval as it is
+    printed.
+*/
+
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include <event.h>
+#include <evhttp.h>
+
+#include "u.h"
+#include "clk.h"
+#include "hist.h"
+#include "wheel.h"
+#include "hstress.h"
+
+static struct{
+    char    *name;
+    size_t  off;
+} ctrs[] = {
+    { "requests", offsetof(struct counters, conns) },
+    { "conn_successes", offsetof(struct counters, conn_successes) },
+    { "conn_errors", offsetof(struct counters, conn_errors) },
+    { "conn_timeouts", offsetof(struct counters, conn_timeouts) },
+    { "conn_opens", offsetof(struct counters, conn_opens) },
+    { "conn_closes", offsetof(struct counters, conn_closes) },
+    { "http_successes", offsetof(struct counters, http_successes) },
+    { "http_errors", offsetof(struct counters, http_errors) },
+    { "late", offsetof(struct counters, late) },
+    { "body_errors", offsetof(struct counters, body_errors) },
+    { "bytes_sent", offsetof(struct counters, bytes_sent) },
+    { "bytes_recvd", offsetof(struct counters, bytes_recvd) },
+};
+#define NCTRS (sizeof(ctrs)/sizeof(ctrs[0]))
+#define ctr(c, i) (*(uint64_t *)((char *)(c) + ctrs[i].off))
+
+static struct evhttp *http;
+
+/* the last interval printed, over usec */
+static struct stats last;
+static uint64_t lastusec;
+
+void
+metricsnote(struct stats *st, uint64_t usec)
+{
+    if(http == nil)
+        return;
+    last = *st;
+    lastusec = usec;
+}
+
+static double
+elapsed()
+{
+    uint64_t now = clknow();
+
+    return now > runstart ? (now - runstart) / 1e6 : 0;
+}
+
+static void
+promquantiles(struct evbuffer *b, char *name, char *labels, Hist *h)
+{
+    int k;
+
+    for(k=0; k<NPCTS; k++)
+        evbuffer_add_printf(b, "%s{%squantile=\"%g\"} %.6f\n", name, labels, pcts[k]/100, histpct(h, pcts[k])/1e6);
+}
+
+static void
+promcb(struct evhttp_request *req, void *arg)
+{
+    struct counters *c = &counts.c;
+    struct evbuffer *b;
+    uint64_t n;
+    char *nm;
+    int i;
+
+    b = evbuffer_new();
+    evbuffer_add_printf(b, "# TYPE hstress_elapsed_seconds gauge\nhstress_elapsed_seconds %.3f\n", elapsed());
+    for(i=0; i<NCTRS; i++){
+        nm = ctrs[i].name;
+        evbuffer_add_printf(b, "# TYPE hstress_%s_total counter\nhstress_%s_total %" PRIu64 "\n", nm, nm, ctr(c, i));
+    }
+
+    // the -b buckets, cumulative as Prometheus has them
+    evbuffer_add_printf(b, "# TYPE hstress_latency_seconds histogram\n");
+    n = 0;
+    for(i=0; params.buckets[i]!=0; i++){
+        n += c->counters[i];
+        evbuffer_add_printf(b, "hstress_latency_seconds_bucket{le=\"%g\"} %" PRIu64 "\n", params.buckets[i]/1000.0, n);
+    }
+    n += c->counters[i];
+    evbuffer_add_printf(b, "hstress_latency_seconds_bucket{le=\"+Inf\"} %" PRIu64 "\n", n);
+    evbuffer_add_printf(b, "hstress_latency_seconds_sum %.6f\n", histmean(&counts.hist) * counts.hist.total / 1e6);
+    evbuffer_add_printf(b, "hstress_latency_seconds_count %" PRIu64 "\n", counts.hist.total);
+
+    evbuffer_add_printf(b, "# TYPE hstress_latency_quantile_seconds gauge\n");
+    promquantiles(b, "hstress_latency_quantile_seconds", "window=\"run\",", &counts.hist);
+    promquantiles(b, "hstress_latency_quantile_seconds", "window=\"interval\",", &last.hist);
+    evbuffer_add_printf(b, "# TYPE hstress_phase_quantile_seconds gauge\n");
+    promquantiles(b, "hstress_phase_quantile_seconds", "phase=\"connect\",", &counts.phase[Pconnect]);
+    promquantiles(b, "hstress_phase_quantile_seconds", "phase=\"ttfb\",", &counts.phase[Pttfb]);
+    if(params.tls){
+        promquantiles(b, "hstress_phase_quantile_seconds", "phase=\"tls_full\",", &counts.phase[Pfull]);
+        promquantiles(b, "hstress_phase_quantile_seconds", "phase=\"tls_resumed\",", &counts.phase[Presumed]);
+    }
+
+    evbuffer_add_printf(b, "# TYPE hstress_interval_requests_per_second gauge\n"
+        "hstress_interval_requests_per_second %.1f\n",
+        lastusec > 0 ? last.c.conn_successes * 1e6 / lastusec : 0);
+    evbuffer_add_printf(b, "# TYPE hstress_interval_bits_per_second gauge\n"
+        "hstress_interval_bits_per_second{dir=\"tx\"} %.0f\n"
+        "hstress_interval_bits_per_second{dir=\"rx\"} %.0f\n",
+        lastusec > 0 ? last.c.bytes_sent * 8e6 / lastusec : 0,
+        lastusec > 0 ? last.c.bytes_recvd * 8e6 / lastusec : 0);
+
+    evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type", "text/plain; version=0.0.4");
+    evhttp_send_reply(req, HTTP_OK, "OK", b);
+    evbuffer_free(b);
+}
+
+/* counters and latencies from st, over usec, as the body of a JSON object */
+static void
+jsonstats(struct evbuffer *b, struct stats *st, uint64_t usec)
+{
+    int i, k;
+
+    evbuffer_add_printf(b, "\"seconds\": %.3f, \"hz\": %.1f", usec / 1e6,
+        usec > 0 ? st->c.conn_successes * 1e6 / usec : 0);
+    for(i=0; i<NCTRS; i++)
+        evbuffer_add_printf(b, ", \"%s\": %" PRIu64, ctrs[i].name, ctr(&st->c, i));
+    evbuffer_add_printf(b, ", \"tx_gbps\": %.6f, \"rx_gbps\": %.6f",
+        usec > 0 ? st->c.bytes_sent * 8e-3 / usec : 0,
+        usec > 0 ? st->c.bytes_recvd * 8e-3 / usec : 0);
+    evbuffer_add_printf(b, ", \"latency_ms\": {\"mean\": %.3f", histmean(&st->hist)/1000);
+    for(k=0; k<NPCTS; k++)
+        evbuffer_add_printf(b, ", \"p%g\": %.3f", pcts[k], histpct(&st->hist, pcts[k])/1000.0);
+    evbuffer_add_printf(b, ", \"max\": %.3f}", histmax(&st->hist)/1000.0);
+}
+
+static void
+jsoncb(struct evhttp_request *req, void *arg)
+{
+    struct evbuffer *b;
+
+    b = evbuffer_new();
+    evbuffer_add_printf(b, "{\"elapsed\": %.3f, \"interval\": {", elapsed());
+    jsonstats(b, &last, lastusec);
+    evbuffer_add_printf(b, "}, \"run\": {");
+    jsonstats(b, &counts, elapsed() * 1e6);
+    evbuffer_add_printf(b, "}}\n");
+
+    evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type", "application/json");
+    evhttp_send_reply(req, HTTP_OK, "OK", b);
+    evbuffer_free(b);
+}
+
+/* the run is over; stop serving, so that the event loop can end */
+void
+metricsdone()
+{
+    if(http != nil)
+        evhttp_free(http);
+    http = nil;
+}
+
+/* serve on [ADDR:]PORT from base */
+void
+mkmetrics(struct event_base *base, char *where)
+{
+    char *addr, *p;
+    int port;
+
+    addr = "0.0.0.0";
+    if((p = strrchr(where, ':')) != nil){
+        addr = strdup(where);
+        addr[p - where] = '\0';
+        p++;
+    }else
+        p = where;
+    if((port = atoi(p)) <= 0)
+        panic("Invalid arguments: -M wants [ADDR:]PORT.");
+
+    if((http = evhttp_new(base)) == nil)
+        panic("evhttp_new");
+    if(evhttp_bind_socket(http, addr, port) != 0)
+        panic("-M: cannot listen on %s:%d", addr, port);
+    evhttp_set_cb(http, "/metrics", promcb, nil);
+    evhttp_set_cb(http, "/json", jsoncb, nil);
+    fprintf(stderr, "# metrics on http://%s:%d/metrics and /json\n", addr, port);
+}
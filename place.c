@@ -0,0 +1,122 @@
+#define _GNU_SOURCE	/* cpu_set_t */
+
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <linux/mempolicy.h>
+
+#include "u.h"
+#include "place.h"
+
+/*
+	A list like 0-3,8,10-11 into *v, in order. Returns how many,
+	or -1 if it is not one.
+*/
+int
+parselist(char *s, int **v)
+{
+	char *p, *q;
+	long lo, hi;
+	int n;
+
+	*v = nil;
+	n = 0;
+	for(p=s;;){
+		lo = strtol(q=p, &p, 10);
+		hi = lo;
+		if(p != q && *p == '-')
+			hi = strtol(q=p+1, &p, 10);
+		if(p == q || lo < 0 || hi < lo || hi >= CPU_SETSIZE)
+			goto bad;
+		for(; lo<=hi; lo++){
+			*v = remal(*v, (n+1) * sizeof(int));
+			(*v)[n++] = lo;
+		}
+		if(*p == '\0')
+			return n;
+		if(*p++ != ',')
+			goto bad;
+	}
+
+bad:
+	free(*v);
+	*v = nil;
+	return -1;
+}
+
+/* whether we may run on cpu */
+int
+cpuok(int cpu)
+{
+	cpu_set_t set;
+
+	if(sched_getaffinity(0, sizeof(set), &set) < 0)
+		panic("sched_getaffinity: %s", strerror(errno));
+	return cpu >= 0 && cpu < CPU_SETSIZE && CPU_ISSET(cpu, &set);
+}
+
+/* whether node is a NUMA node, with CPUs */
+int
+nodeok(int node)
+{
+	char path[64];
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+	return access(path, R_OK) == 0;
+}
+
+void
+pincpu(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if(sched_setaffinity(0, sizeof(set), &set) < 0)
+		panic("sched_setaffinity %d: %s", cpu, strerror(errno));
+}
+
+/*
+	Run only on node's CPUs, as listed by sysfs, and prefer its
+	memory. Only preferred: should the node run out, memory from
+	elsewhere beats failing.
+*/
+void
+pinnode(int node)
+{
+	char path[64], buf[4096];
+	unsigned long mask[CPU_SETSIZE/(8*sizeof(unsigned long))];
+	cpu_set_t set;
+	FILE *f;
+	int *cpus, i, n;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+	if((f = fopen(path, "r")) == nil)
+		panic("no NUMA node %d: %s", node, strerror(errno));
+	if(fgets(buf, sizeof(buf), f) == nil)
+		buf[0] = '\0';
+	fclose(f);
+	buf[strcspn(buf, "\n")] = '\0';
+
+	if((n = parselist(buf, &cpus)) <= 0)
+		panic("NUMA node %d has no CPUs", node);
+	CPU_ZERO(&set);
+	for(i=0; i<n; i++)
+		CPU_SET(cpus[i], &set);
+	free(cpus);
+	if(sched_setaffinity(0, sizeof(set), &set) < 0)
+		panic("sched_setaffinity node %d: %s", node, strerror(errno));
+
+	if(node >= CPU_SETSIZE)
+		return;
+	memset(mask, 0, sizeof(mask));
+	mask[node / (8*sizeof(unsigned long))] |= 1UL << node % (8*sizeof(unsigned long));
+	if(syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, CPU_SETSIZE) < 0)
+		panic("set_mempolicy node %d: %s", node, strerror(errno));
+}
@@ -0,0 +1,11 @@
+/*
+	Placing workers on CPUs and NUMA nodes. Linux only; the
+	placement applies to the calling thread, and memory comes from
+	its node once it has been placed.
+*/
+
+int parselist(char *s, int **v);
+int cpuok(int cpu);
+int nodeok(int node);
+void pincpu(int cpu);
+void pinnode(int node);
@@ -0,0 +1,951 @@
+/*
+    A raw HTTP/1.1 engine for hstress.
+
+    Requests are serialized once at startup (see tmpl.c) and written
+    straight from there, their bodies from the file mapped for them.
+    Responses are read into a fixed per-connection buffer and parsed
+    in place: just enough to find the status, the Content-Length or
+    chunked framing, and whether the server wants to close. Bodies
+    are dropped as they come, summed first with -x. Once a runner's
+    connection is set up, requests allocate nothing.
+
+    With -P, up to params.depth requests are pipelined on each
+    connection. They sit in a ring on the connection in the order
+    sent, which is the order their responses come back in; whatever
+    has not been written yet goes out in one writev.
+
+    -E uring does the same over io_uring: connects, reads and writes
+    for every connection in a worker are queued on one ring and go
+    to the kernel in a single io_uring_enter per pass of the event
+    loop, and their completions come back in batches, instead of
+    costing a read or write (and an epoll wakeup) each.
+
+    With -e, -E raw speaks TLS: the handshake follows the connect,
+    and reads and writes go through OpenSSL, a record for each
+    piece that writev would have sent.
+*/
+
+#define _GNU_SOURCE     /* memmem */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <event.h>
+#include <evhttp.h>
+#include <linux/io_uring.h>
+#include <openssl/ssl.h>
+
+#include "u.h"
+#include "clk.h"
+#include "hist.h"
+#include "wheel.h"
+#include "hstress.h"
+#include "uring.h"
+
+/* the response head (status line and headers) must fit in here */
+#define RAWBUF 16384
+
+/* most iovecs written by one writev: a head, and perhaps a body, per request */
+#define RAWIOV 64
+
+/* io_uring operations, as tagged in their user data */
+enum{
+    Uconnect = 1,
+    Urecv,
+    Uwrite,
+};
+
+enum{
+    Rhead,          /* status line and headers */
+    Rbody,          /* Content-Length bytes */
+    Rchunksize,     /* a chunk-size line */
+    Rchunk,         /* chunk data */
+    Rchunkend,      /* the CRLF after chunk data */
+    Rtrailer,       /* trailer lines up to an empty one */
+    Reof,           /* body runs to end of connection */
+};
+
+struct conn{
+    runner          *run;
+    int             fd;
+    int             gen;            /* bumped as fd comes and goes */
+    int             connecting;
+    int             handshaking;    /* -e: TCP is up, TLS is not yet */
+    SSL             *ssl;
+    int             err;            /* failed; rawwritecb reports it */
+    int             inread;         /* rawinput flushes when done */
+    struct event    rev;
+    struct event    wev;
+
+    /* io_uring: a recv or writev is out, perhaps for an older fd */
+    int             rbusy;
+    int             wbusy;
+    struct iovec    iov[RAWIOV];
+    char            iovend[RAWIOV];
+
+    /*
+        Requests in flight, oldest first, in a ring of params.depth.
+        They are numbered as sent; seq is the number of the oldest.
+    */
+    struct request  *reqs;
+    int             head;
+    int             nreq;
+    unsigned        seq;
+
+    /* requests before wseq are written, and wpos bytes of wseq */
+    unsigned        wseq;
+    size_t          wpos;
+
+    /* response parser */
+    int             state;
+    int             status;
+    int             close;
+    int64_t         left;
+
+    int             rpos;
+    int             rlen;
+    uint64_t        rsize;          /* of the response being parsed, so far */
+    char            buf[RAWBUF];
+};
+
+static struct sockaddr_storage addr;
+static socklen_t addrlen;
+
+static int rawuring;
+
+static void rawreadcb(int fd, short what, void *arg);
+static void rawup(runner *run);
+static void rawwritecb(int fd, short what, void *arg);
+static void rawuringcb(void *arg, uint64_t data, int res);
+
+/*
+    io_uring user data: the connection, the operation, and the low
+    bits of the generation it was asked of, so that completions for
+    a connection since closed can be told apart. struct conn comes
+    from calloc, so the low bits of its address are free, and user
+    space addresses fit in 48 bits.
+*/
+#define rawtag(c, op)   ((uint64_t)(uintptr_t)(c) | (op) | (uint64_t)((c)->gen & 0xffff) << 48)
+#define tagconn(t)      ((struct conn *)(uintptr_t)((t) & ((1ULL<<48) - 1) & ~7ULL))
+#define tagop(t)        ((int)((t) & 7))
+#define taggen(t)       ((int)((t) >> 48))
+
+static void
+rawinit(void)
+{
+    targetaddr(&addr, &addrlen);
+}
+
+static void
+uringinit(void)
+{
+    char *why;
+
+    if((why = uringprobe()) != nil){
+        fprintf(stderr, "# io_uring unavailable (%s), using -E raw\n", why);
+        engine = &rawengine;
+    }else
+        rawuring = 1;
+    rawinit();
+}
+
+static void
+rawopen(runner *run)
+{
+    struct conn *c;
+    struct io_uring_sqe *sqe;
+    int fd, one = 1;
+
+    if(run->conn == nil){
+        if((run->conn = calloc(1, sizeof(struct conn))) == nil)
+            panic("calloc");
+        if((run->conn->reqs = calloc(params.depth, sizeof(struct request))) == nil)
+            panic("calloc");
+        run->conn->run = run;
+        run->conn->fd = -1;
+    }
+    c = run->conn;
+
+    if((fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0)
+        panic("socket: %s", strerror(errno));
+    if(addr.ss_family != AF_UNIX)
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    bindsrc(run->w, fd);
+
+    c->fd = fd;
+    c->gen++;
+    c->state = Rhead;
+    c->rpos = c->rlen = 0;
+    c->rsize = 0;
+    c->connecting = 1;
+    c->err = 0;
+    connecting(run);
+
+    if(rawuring){
+        // a recv and a writev each, and room for ones still out on a closed fd
+        if(run->w->uring == nil)
+            run->w->uring = mkuring(run->w->base, 8*params.concurrency, rawuringcb, nil);
+        sqe = uringsqe(run->w->uring);
+        sqe->opcode = IORING_OP_CONNECT;
+        sqe->fd = fd;
+        sqe->addr = (uintptr_t)&addr;
+        sqe->off = addrlen;
+        sqe->user_data = rawtag(c, Uconnect);
+        return;
+    }
+
+    if(connect(fd, (struct sockaddr *)&addr, addrlen) < 0){
+        if(errno != EINPROGRESS)
+            c->err = errno;
+    }else
+        rawup(run);
+
+    event_set(&c->rev, fd, EV_READ | EV_PERSIST, rawreadcb, run);
+    event_base_set(run->w->base, &c->rev);
+    event_add(&c->rev, nil);
+    event_set(&c->wev, fd, EV_WRITE, rawwritecb, run);
+    event_base_set(run->w->base, &c->wev);
+    if(c->err)
+        event_active(&c->wev, EV_WRITE, 1);
+    else if(c->connecting || c->handshaking)
+        event_add(&c->wev, nil);
+}
+
+static void
+rawclose(runner *run)
+{
+    struct conn *c = run->conn;
+
+    if(c == nil || c->fd < 0)
+        return;
+
+    if(c->ssl != nil){
+        tlsclose(c->ssl);
+        SSL_free(c->ssl);
+        c->ssl = nil;
+    }
+    c->handshaking = 0;
+    churnclose(c->fd);
+    if(rawuring){
+        // a recv still out would otherwise keep the socket open
+        shutdown(c->fd, SHUT_RDWR);
+    }else{
+        event_del(&c->rev);
+        event_del(&c->wev);
+    }
+    close(c->fd);
+    c->fd = -1;
+    c->gen++;
+    bump(run->w->stats->c.conn_closes);
+}
+
+static struct request *
+rawnewreq(runner *run)
+{
+    struct conn *c = run->conn;
+    struct request *req;
+
+    req = &c->reqs[(c->head + c->nreq++) % params.depth];
+    memset(req, 0, sizeof(*req));
+    return req;
+}
+
+static void
+rawfreereq(runner *run, struct request *req)
+{
+}
+
+/* take the oldest request off the ring */
+static struct request *
+rawpop(struct conn *c)
+{
+    struct request *req = &c->reqs[c->head];
+
+    c->head = (c->head + 1) % params.depth;
+    c->nreq--;
+    c->seq++;
+    return req;
+}
+
+/* the template of the request numbered seq */
+static struct tmpl *
+rawtmpl(struct conn *c, unsigned seq)
+{
+    return &tmpls[c->reqs[(c->head + (seq - c->seq)) % params.depth].tmpl];
+}
+
+/*
+    Point iov at what is still to be written: each request's head,
+    then its body if it has one, straight from the template and the
+    file mapped for it. end[i] says whether iov[i] ends a request.
+    Returns how many.
+*/
+static int
+rawiov(struct conn *c, struct iovec *iov, char *end)
+{
+    struct tmpl *t;
+    unsigned seq;
+    size_t off;
+    int n;
+
+    if((int)(c->wseq - c->seq) < 0){
+        // answered before we finished asking
+        c->wseq = c->seq;
+        c->wpos = 0;
+    }
+    n = 0;
+    off = c->wpos;
+    for(seq=c->wseq; (int)(seq - c->seq) < c->nreq && n+2 <= RAWIOV; seq++){
+        t = rawtmpl(c, seq);
+        if(off < t->rawlen){
+            iov[n].iov_base = t->raw + off;
+            iov[n].iov_len = t->rawlen - off;
+            end[n++] = 0;
+            off = 0;
+        }else
+            off -= t->rawlen;
+        if(t->bodylen > 0){
+            iov[n].iov_base = t->body + off;
+            iov[n].iov_len = t->bodylen - off;
+            end[n++] = 0;
+            off = 0;
+        }
+        end[n-1] = 1;
+    }
+    return n;
+}
+
+/* n bytes of iov, as rawiov made it, went out */
+static void
+rawwrote(struct conn *c, struct iovec *iov, char *end, size_t n)
+{
+    int i;
+
+    add(c->run->w->stats->c.bytes_sent, n);
+    for(i=0; n > 0; i++){
+        if(n < iov[i].iov_len){
+            c->wpos += n;
+            break;
+        }
+        n -= iov[i].iov_len;
+        c->wpos += iov[i].iov_len;
+        if(end[i]){
+            c->wseq++;
+            c->wpos = 0;
+        }
+    }
+}
+
+/* writev, or with TLS as much of iov[0] as SSL_write will take */
+static ssize_t
+rawwritev(struct conn *c, struct iovec *iov, int niov)
+{
+    int n;
+
+    if(c->ssl == nil)
+        return writev(c->fd, iov, niov);
+    if((n = SSL_write(c->ssl, iov[0].iov_base, iov[0].iov_len)) > 0)
+        return n;
+    switch(SSL_get_error(c->ssl, n)){
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        errno = EAGAIN;
+        break;
+    default:
+        errno = EPROTO;
+        break;
+    }
+    return -1;
+}
+
+/* read, or SSL_read */
+static int
+rawread(struct conn *c, char *p, int n)
+{
+    if(c->ssl == nil)
+        return read(c->fd, p, n);
+    if((n = SSL_read(c->ssl, p, n)) > 0)
+        return n;
+    switch(SSL_get_error(c->ssl, n)){
+    case SSL_ERROR_ZERO_RETURN:
+        return 0;
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        errno = EAGAIN;
+        break;
+    default:
+        errno = EPROTO;
+        break;
+    }
+    return -1;
+}
+
+/*
+    Write what we can; returns -1 if the connection failed. With
+    io_uring this only queues the write, one at a time.
+*/
+static int
+rawflush(runner *run)
+{
+    struct conn *c = run->conn;
+    struct io_uring_sqe *sqe;
+    struct iovec iov[RAWIOV];
+    char end[RAWIOV];
+    ssize_t n;
+    int niov;
+
+    if(rawuring){
+        if(c->wbusy || (niov = rawiov(c, c->iov, c->iovend)) == 0)
+            return 0;
+        sqe = uringsqe(run->w->uring);
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->fd = c->fd;
+        sqe->addr = (uintptr_t)c->iov;
+        sqe->len = niov;
+        sqe->user_data = rawtag(c, Uwrite);
+        c->wbusy = 1;
+        return 0;
+    }
+
+    while((niov = rawiov(c, iov, end)) > 0){
+        n = rawwritev(c, iov, niov);
+        if(n < 0){
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN){
+                event_add(&c->wev, nil);
+                return 0;
+            }
+            return -1;
+        }
+        rawwrote(c, iov, end, n);
+    }
+    return 0;
+}
+
+/*
+    The connection is gone: hand back everything that was in flight
+    on it, oldest first. That is answered if the server got that far
+    before closing, otherwise expired as a timeout or an error. They
+    come off the ring first, so that whatever complete() sends goes
+    out behind them on a fresh connection; and since complete()
+    counts each as in flight until it is handed back, in ring order,
+    the new requests cannot lap them.
+*/
+static void
+rawabort(runner *run, struct request *answered, struct request *expired)
+{
+    struct conn *c = run->conn;
+    struct request *req;
+    int i, n;
+
+    rawclose(run);
+
+    i = c->head;
+    n = c->nreq;
+    c->head = (c->head + n) % params.depth;
+    c->seq += n;
+    c->wseq = c->seq;
+    c->nreq = c->wpos = 0;
+
+    while(n-- > 0){
+        req = &c->reqs[i];
+        i = (i + 1) % params.depth;
+        if(req == answered)
+            complete(Success, req);
+        else
+            complete(req == expired ? Timeout : Error, req);
+    }
+}
+
+static void
+rawfail(runner *run)
+{
+    rawabort(run, nil, nil);
+}
+
+static void
+rawexpire(struct request *req)
+{
+    rawabort(req->run, nil, req);
+}
+
+static void
+rawsend(runner *run, struct request *req)
+{
+    struct conn *c = run->conn;
+
+    // the server may have closed an idle connection since
+    if(c->fd < 0)
+        rawopen(run);
+
+    /*
+        Failures are reported from the event loop rather than from
+        here, where complete() would call straight back into us.
+        Requests sent while responses are being read go out
+        together once the read is done.
+    */
+    if(!c->connecting && !c->handshaking && !c->inread && rawflush(run) < 0){
+        c->err = errno;
+        event_active(&c->wev, EV_WRITE, 1);
+    }
+}
+
+/* TCP is up; with -e, TLS is next */
+static void
+rawup(runner *run)
+{
+    struct conn *c = run->conn;
+
+    c->connecting = 0;
+    connected(run);
+    if(params.tls){
+        c->ssl = tlsnew(run);
+        SSL_set_fd(c->ssl, c->fd);
+        c->handshaking = 1;
+    }
+}
+
+/* take the handshake as far as it will go; -1 if it failed */
+static int
+rawshake(runner *run)
+{
+    struct conn *c = run->conn;
+    int n;
+
+    if((n = SSL_do_handshake(c->ssl)) == 1){
+        c->handshaking = 0;
+        return rawflush(run);
+    }
+    switch(SSL_get_error(c->ssl, n)){
+    case SSL_ERROR_WANT_READ:
+        return 0;
+    case SSL_ERROR_WANT_WRITE:
+        event_add(&c->wev, nil);
+        return 0;
+    }
+    return -1;
+}
+
+static void
+rawwritecb(int fd, short what, void *arg)
+{
+    runner *run = (runner *)arg;
+    struct conn *c = run->conn;
+    socklen_t len;
+    int err;
+
+    clkstale();
+    if(c->err){
+        rawfail(run);
+        return;
+    }
+
+    if(c->connecting){
+        len = sizeof(err);
+        if(getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0){
+            rawfail(run);
+            return;
+        }
+        rawup(run);
+    }
+
+    if(c->handshaking ? rawshake(run) < 0 : rawflush(run) < 0)
+        rawfail(run);
+}
+
+/* the oldest request is answered; hand it back */
+static void
+rawdone(runner *run)
+{
+    struct conn *c = run->conn;
+    struct request *req;
+    uint64_t size;
+
+    c->state = Rhead;
+    size = c->rsize;
+    c->rsize = 0;
+    if(c->close){
+        // nothing pipelined behind this will be answered
+        req = &c->reqs[c->head];
+        req->status = c->status;
+        req->size = size;
+        rawabort(run, req, nil);
+        return;
+    }
+    req = rawpop(c);
+    req->status = c->status;
+    req->size = size;
+    complete(Success, req);
+}
+
+/* find a CRLF-terminated line at p; returns its length without CRLF, or -1 */
+static int
+rawline(char *p, int n)
+{
+    char *e;
+
+    if((e = memchr(p, '\n', n)) == nil)
+        return -1;
+    if(e > p && e[-1] == '\r')
+        e--;
+    return e - p;
+}
+
+/*
+    Parse the response head at buf[rpos:rlen]. Returns the number of
+    bytes it took, 0 if it is not all here yet, or -1 if it is bad.
+*/
+static int
+rawhead(struct conn *c)
+{
+    char *p, *e, *end, *v;
+    int n, http10, keepalive, chunked;
+
+    p = c->buf + c->rpos;
+    n = c->rlen - c->rpos;
+    if((end = memmem(p, n, "\r\n\r\n", 4)) == nil)
+        return 0;
+    end += 4;
+
+    if(n < 12 || strncmp(p, "HTTP/1.", 7) != 0)
+        return -1;
+    http10 = p[7] == '0';
+    c->status = atoi(p + 9);
+    if(c->status < 100)
+        return -1;
+
+    c->left = -1;
+    chunked = 0;
+    keepalive = 0;
+    c->close = 0;
+
+    p = memchr(p, '\n', end - p) + 1;
+    while(p < end - 2){
+        e = memchr(p, '\n', end - p);
+        if((v = memchr(p, ':', e - p)) != nil){
+            for(v++; *v == ' ' || *v == '\t'; v++);
+            if(strncasecmp(p, "content-length:", 15) == 0)
+                c->left = strtoll(v, nil, 10);
+            else if(strncasecmp(p, "transfer-encoding:", 18) == 0)
+                chunked = strncasecmp(v, "chunked", 7) == 0;
+            else if(strncasecmp(p, "connection:", 11) == 0){
+                if(strncasecmp(v, "close", 5) == 0)
+                    c->close = 1;
+                else if(strncasecmp(v, "keep-alive", 10) == 0)
+                    keepalive = 1;
+            }
+        }
+        p = e + 1;
+    }
+
+    // an interim response (100 Continue, 103 Early Hints): the final one follows
+    if(c->status < 200 && c->status != 101){
+        c->close = 0;
+        return end - (c->buf + c->rpos);
+    }
+
+    if(http10 && !keepalive)
+        c->close = 1;
+
+    // none of these has a body, nor does any response to a HEAD
+    if(c->status == 204 || c->status == 304 || c->status < 200 || rawtmpl(c, c->seq)->nobody)
+        c->left = 0;
+    else if(chunked)
+        c->state = Rchunksize;
+    else if(c->left < 0){
+        c->state = Reof;
+        c->close = 1;
+    }
+
+    if(c->state == Rhead)
+        c->state = Rbody;
+
+    return end - (c->buf + c->rpos);
+}
+
+/* the parser is done with n more bytes of the response */
+static void
+rawtake(struct conn *c, int n)
+{
+    c->rpos += n;
+    c->rsize += n;
+}
+
+/* n more bytes of the oldest request's body, at p */
+static void
+rawsum(struct conn *c, char *p, int n)
+{
+    struct request *req = &c->reqs[c->head];
+
+    if(params.checksum)
+        req->sum = bodysum(req->sum, p, n);
+}
+
+/*
+    Run the parser over everything buffered. Returns -1 on a
+    protocol error, otherwise 0 once it needs more input.
+*/
+static int
+rawparse(runner *run)
+{
+    struct conn *c = run->conn;
+    int n, avail, gen;
+    char *p;
+
+    gen = c->gen;
+    while(c->gen == gen && c->rpos < c->rlen){
+        p = c->buf + c->rpos;
+        avail = c->rlen - c->rpos;
+
+        // nothing is in flight; whatever this is, we did not ask for it
+        if(c->nreq == 0)
+            return -1;
+
+        switch(c->state){
+        case Rhead:
+            if(c->reqs[c->head].first == 0)
+                c->reqs[c->head].first = clk();
+            if((n = rawhead(c)) <= 0)
+                return n;
+            rawtake(c, n);
+            if(c->state == Rbody && c->left == 0)
+                rawdone(run);
+            break;
+
+        case Rbody:
+            n = avail < c->left ? avail : c->left;
+            rawsum(c, p, n);
+            rawtake(c, n);
+            c->left -= n;
+            if(c->left == 0)
+                rawdone(run);
+            break;
+
+        case Reof:
+            rawsum(c, p, avail);
+            rawtake(c, avail);
+            break;
+
+        case Rchunksize:
+            if((n = rawline(p, avail)) < 0)
+                return 0;
+            c->left = strtoll(p, nil, 16);
+            rawtake(c, (char *)memchr(p, '\n', avail) - p + 1);
+            c->state = c->left == 0 ? Rtrailer : Rchunk;
+            break;
+
+        case Rchunk:
+            n = avail < c->left ? avail : c->left;
+            rawsum(c, p, n);
+            rawtake(c, n);
+            c->left -= n;
+            if(c->left == 0)
+                c->state = Rchunkend;
+            break;
+
+        case Rchunkend:
+        case Rtrailer:
+            if((n = rawline(p, avail)) < 0)
+                return 0;
+            rawtake(c, (char *)memchr(p, '\n', avail) - p + 1);
+            if(c->state == Rchunkend)
+                c->state = Rchunksize;
+            else if(n == 0)
+                rawdone(run);
+            break;
+        }
+    }
+    return 0;
+}
+
+/* make room at the end of buf; -1 if a response head fills it */
+static int
+rawcompact(struct conn *c)
+{
+    if(c->rpos == c->rlen)
+        c->rpos = c->rlen = 0;
+    else if(c->rpos > 0){
+        memmove(c->buf, c->buf + c->rpos, c->rlen - c->rpos);
+        c->rlen -= c->rpos;
+        c->rpos = 0;
+    }
+    return c->rlen == sizeof(c->buf) ? -1 : 0;
+}
+
+/* n bytes have come in at the end of buf; 0 is end of file, -1 an error */
+static void
+rawinput(runner *run, int n)
+{
+    struct conn *c = run->conn;
+
+    if(n <= 0){
+        if(n == 0 && c->state == Reof && c->nreq > 0){
+            c->close = 1;
+            rawdone(run);
+        }else
+            rawfail(run);
+        return;
+    }
+    c->rlen += n;
+
+    c->inread = 1;
+    n = rawparse(run);
+    c->inread = 0;
+    if(n < 0){
+        rawfail(run);
+        return;
+    }
+    if(c->fd >= 0 && !c->connecting && !c->handshaking && rawflush(run) < 0){
+        c->err = errno;
+        event_active(&c->wev, EV_WRITE, 1);
+    }
+}
+
+static void
+rawreadcb(int fd, short what, void *arg)
+{
+    runner *run = (runner *)arg;
+    struct conn *c = run->conn;
+    int n, gen;
+
+    clkstale();
+    if(c->handshaking){
+        if(rawshake(run) < 0)
+            rawfail(run);
+        return;
+    }
+
+    // TLS may hold on to more of a record than was asked for
+    gen = c->gen;
+    do{
+        if(rawcompact(c) < 0){
+            rawfail(run);
+            return;
+        }
+        n = rawread(c, c->buf + c->rlen, sizeof(c->buf) - c->rlen);
+        if(n < 0 && (errno == EAGAIN || errno == EINTR))
+            return;
+        rawinput(run, n < 0 ? -1 : n);
+    }while(c->gen == gen && c->ssl != nil && SSL_pending(c->ssl) > 0);
+}
+
+/* queue a recv unless one is already out */
+static void
+rawrecv(runner *run)
+{
+    struct conn *c = run->conn;
+    struct io_uring_sqe *sqe;
+
+    if(c->rbusy)
+        return;
+    if(rawcompact(c) < 0){
+        rawfail(run);
+        return;
+    }
+    sqe = uringsqe(run->w->uring);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->fd;
+    sqe->addr = (uintptr_t)(c->buf + c->rlen);
+    sqe->len = sizeof(c->buf) - c->rlen;
+    sqe->user_data = rawtag(c, Urecv);
+    c->rbusy = 1;
+}
+
+/*
+    An io_uring completion. One for an fd since closed only means
+    that the next recv or writev can go out on the current one.
+*/
+static void
+rawuringcb(void *arg, uint64_t data, int res)
+{
+    struct conn *c = tagconn(data);
+    runner *run = c->run;
+    int stale, ready;
+
+    clkstale();
+    stale = taggen(data) != (c->gen & 0xffff);
+    ready = c->fd >= 0 && !c->connecting;
+
+    switch(tagop(data)){
+    case Uconnect:
+        if(stale)
+            break;
+        if(res < 0){
+            rawfail(run);
+            break;
+        }
+        c->connecting = 0;
+        connected(run);
+        rawrecv(run);
+        rawflush(run);
+        break;
+
+    case Urecv:
+        c->rbusy = 0;
+        if(stale){
+            if(ready)
+                rawrecv(run);
+            break;
+        }
+        if(res == -EINTR || res == -EAGAIN){
+            rawrecv(run);
+            break;
+        }
+        rawinput(run, res < 0 ? -1 : res);
+        if(c->fd >= 0 && !c->connecting)
+            rawrecv(run);
+        break;
+
+    case Uwrite:
+        c->wbusy = 0;
+        if(stale){
+            if(ready)
+                rawflush(run);
+            break;
+        }
+        if(res < 0){
+            rawfail(run);
+            break;
+        }
+        rawwrote(c, c->iov, c->iovend, res);
+        rawflush(run);
+        break;
+    }
+}
+
+struct engine rawengine = {
+    "raw",
+    rawinit,
+    rawopen,
+    rawclose,
+    rawnewreq,
+    rawfreereq,
+    rawsend,
+    rawexpire,
+};
+
+struct engine uringengine = {
+    "uring",
+    uringinit,
+    rawopen,
+    rawclose,
+    rawnewreq,
+    rawfreereq,
+    rawsend,
+    rawexpire,
+};
@@ -0,0 +1,130 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "u.h"
+#include "src.h"
+
+struct range{
+	struct sockaddr_storage base;
+	socklen_t len;
+	uint64_t n;
+};
+
+static struct range *ranges;
+static int nranges;
+static uint64_t total;
+
+/*
+	The low 32 bits of an address, where a prefix's host part
+	lives: a prefix may leave no more than 32 of them.
+*/
+static uint32_t *
+low32(struct sockaddr_storage *ss)
+{
+	if(ss->ss_family == AF_INET)
+		return &((struct sockaddr_in *)ss)->sin_addr.s_addr;
+	return (uint32_t *)&((struct sockaddr_in6 *)ss)->sin6_addr.s6_addr[12];
+}
+
+/* how many addresses s lists, or 0 if it is not a list */
+uint64_t
+srcparse(char *s)
+{
+	struct range *r;
+	char *dup, *p, *q, *e;
+	uint32_t *a, host;
+	long bits;
+	int max;
+
+	dup = strdup(s);
+	for(p=dup; (q = strsep(&p, ",")) != nil;){
+		if(*q == '\0')
+			continue;
+		ranges = remal(ranges, (nranges+1) * sizeof(struct range));
+		r = &ranges[nranges++];
+		memset(r, 0, sizeof(*r));
+
+		bits = -1;
+		if((e = strchr(q, '/')) != nil){
+			*e++ = '\0';
+			bits = strtol(e, &e, 10);
+			if(*e != '\0')
+				goto bad;
+		}
+		if(inet_pton(AF_INET, q, &((struct sockaddr_in *)&r->base)->sin_addr) == 1){
+			r->base.ss_family = AF_INET;
+			r->len = sizeof(struct sockaddr_in);
+			max = 32;
+		}else if(inet_pton(AF_INET6, q, &((struct sockaddr_in6 *)&r->base)->sin6_addr) == 1){
+			r->base.ss_family = AF_INET6;
+			r->len = sizeof(struct sockaddr_in6);
+			max = 128;
+		}else
+			goto bad;
+		if(r->base.ss_family != ranges[0].base.ss_family)
+			goto bad;
+		if(bits < 0)
+			bits = max;
+		if(bits > max || max - bits > 32)
+			goto bad;
+
+		a = low32(&r->base);
+		host = max - bits == 32 ? ~0U : (1U << (max - bits)) - 1;
+		*a = htonl(ntohl(*a) & ~host);
+		r->n = (uint64_t)host + 1;
+		if(r->n > 2 && max == 32){
+			*a = htonl(ntohl(*a) + 1);
+			r->n -= 2;
+		}else if(r->n > 1 && max == 128){
+			*a = htonl(ntohl(*a) + 1);
+			r->n -= 1;
+		}
+		total += r->n;
+	}
+	free(dup);
+	return total;
+
+bad:
+	free(dup);
+	free(ranges);
+	ranges = nil;
+	nranges = 0;
+	total = 0;
+	return 0;
+}
+
+void
+srcaddr(uint64_t k, struct sockaddr_storage *ss, socklen_t *len)
+{
+	struct range *r;
+	uint32_t *a;
+
+	k %= total;
+	for(r=ranges; k>=r->n; r++)
+		k -= r->n;
+	*ss = r->base;
+	*len = r->len;
+	a = low32(ss);
+	*a = htonl(ntohl(*a) + (uint32_t)k);
+}
+
+/* ss's address, as text */
+char *
+srcname(struct sockaddr_storage *ss, char *buf, size_t n)
+{
+	void *a;
+
+	if(ss->ss_family == AF_INET)
+		a = &((struct sockaddr_in *)ss)->sin_addr;
+	else
+		a = &((struct sockaddr_in6 *)ss)->sin6_addr;
+	if(inet_ntop(ss->ss_family, a, buf, n) == nil)
+		Scp(buf, "?", n);
+	return buf;
+}
@@ -0,0 +1,14 @@
+/*
+	Local addresses to connect from: a list like
+	127.0.0.2,127.1.0.0/16 or fd00::1,fd00::/112, all of one
+	family. A prefix stands for each of its hosts, less an IPv4
+	network's first and last address and an IPv6 one's first.
+	They are numbered in order across the list; srcaddr gives
+	the k'th, wrapping around, without ever listing them all.
+
+	Callers include <sys/socket.h> first.
+*/
+
+uint64_t srcparse(char *s);
+void srcaddr(uint64_t k, struct sockaddr_storage *ss, socklen_t *len);
+char *srcname(struct sockaddr_storage *ss, char *buf, size_t n);
@@ -0,0 +1,120 @@
+/*
+    TLS for hstress, with -e RESUME.
+
+    Each runner keeps the last session ticket its server gave it.
+    A new connection offers that session, to be resumed, RESUME
+    percent of the time, and otherwise does a full handshake. The
+    handshake is timed from when TCP was up until it was done, and
+    recorded once a connection, as a full or a resumed one by what
+    the server did, whatever was asked.
+
+    Certificates are not checked: this is for load, not trust.
+*/
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <event.h>
+#include <evhttp.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include "u.h"
+#include "clk.h"
+#include "hist.h"
+#include "wheel.h"
+#include "hstress.h"
+
+static SSL_CTX *ctx;
+
+/* SNI goes with names, not addresses */
+static int sni;
+
+/* the runner the SSL is for */
+static runner *
+sslrun(const SSL *ssl)
+{
+    return SSL_get_app_data(ssl);
+}
+
+/* the server sent a session to resume; keep it for the runner's next connection */
+static int
+newsesscb(SSL *ssl, SSL_SESSION *sess)
+{
+    runner *run = sslrun(ssl);
+
+    if(run->tlssess != nil)
+        SSL_SESSION_free(run->tlssess);
+    run->tlssess = sess;
+    return 1;
+}
+
+static void
+infocb(const SSL *ssl, int where, int ret)
+{
+    runner *run = sslrun(ssl);
+    struct stats *st = run->w->stats;
+
+    // TLS 1.3 says it is done again after each ticket
+    if(!(where & SSL_CB_HANDSHAKE_DONE) || run->tlsgen == run->conngen || run->connat == 0)
+        return;
+    run->tlsgen = run->conngen;
+    histrecord(&st->phase[SSL_session_reused((SSL *)ssl) ? Presumed : Pfull], clk() - run->connat);
+}
+
+void
+tlsinit(void)
+{
+    struct in6_addr a;
+
+    if((ctx = SSL_CTX_new(TLS_client_method())) == nil)
+        panic("SSL_CTX_new: %s", ERR_error_string(ERR_get_error(), nil));
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, nil);
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    // a server that closes without close_notify ends a body like any other
+    SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+    SSL_CTX_set_alpn_protos(ctx, (unsigned char *)"\x08http/1.1", 9);
+
+    // sessions are kept by runner, not in the context's cache
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, newsesscb);
+    SSL_CTX_set_info_callback(ctx, infocb);
+
+    sni = !http_unix && inet_pton(AF_INET, http_hostname, &a) != 1 && inet_pton(AF_INET6, http_hostname, &a) != 1;
+}
+
+/* an SSL for run's next connection, resuming its last session or not */
+SSL *
+tlsnew(runner *run)
+{
+    SSL *ssl;
+
+    if((ssl = SSL_new(ctx)) == nil)
+        panic("SSL_new: %s", ERR_error_string(ERR_get_error(), nil));
+    SSL_set_app_data(ssl, run);
+    SSL_set_connect_state(ssl);
+    if(sni)
+        SSL_set_tlsext_host_name(ssl, http_hostname);
+    if(run->tlssess != nil && erand48(run->w->xsubi) * 100 < params.resume)
+        SSL_set_session(ssl, run->tlssess);
+    return ssl;
+}
+
+/*
+    Done with ssl, which is about to be freed. It is not shut down,
+    which would cost a write, but marked as if it had been, lest
+    OpenSSL take its session for a bad one and refuse to resume it.
+*/
+void
+tlsclose(SSL *ssl)
+{
+    SSL_set_shutdown(ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+}
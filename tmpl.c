@@ -0,0 +1,370 @@
+/*
+    Request templates for hstress.
+
+    With -f, requests are drawn from a file of templates, one to a
+    line, with tab-separated fields:
+
+        [WEIGHT]    METHOD  PATH    [Name: value]...  [@BODY]
+
+    Blank lines and lines starting with # are skipped. WEIGHT is
+    relative and defaults to 1. BODY is a file whose contents are
+    sent as the request body. Without -f there is one template:
+    the -m method (GET, or POST with a -d body) of the -u path.
+
+    Body files are mapped once, however many templates use them,
+    and sent from the mapping by reference: requests never copy
+    them, whatever their size.
+
+    Each template is serialized once, here; the raw engines write
+    those bytes as they are, and -E h2 a HEADERS frame made the same
+    way, with only its stream to fill in.
+
+    Templates are picked per request in constant time with an alias
+    table (Vose's method): one uniform draw picks a column, and a
+    second, taken from the same draw, picks between the column's own
+    template and its alias.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <ctype.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <event.h>
+#include <evhttp.h>
+
+#include "u.h"
+#include "hist.h"
+#include "hpack.h"
+#include "wheel.h"
+#include "hstress.h"
+
+struct tmpl *tmpls;
+int ntmpls;
+
+/* the alias table: column i is template i with probability prob[i], else alias[i] */
+static double *prob;
+static int *alias;
+
+static struct{
+    char *name;
+    enum evhttp_cmd_type cmd;
+} methods[] = {
+    { "GET", EVHTTP_REQ_GET },
+    { "POST", EVHTTP_REQ_POST },
+    { "HEAD", EVHTTP_REQ_HEAD },
+    { "PUT", EVHTTP_REQ_PUT },
+    { "DELETE", EVHTTP_REQ_DELETE },
+    { "OPTIONS", EVHTTP_REQ_OPTIONS },
+    { "TRACE", EVHTTP_REQ_TRACE },
+    { "CONNECT", EVHTTP_REQ_CONNECT },
+    { "PATCH", EVHTTP_REQ_PATCH },
+};
+
+/* body files, mapped */
+static struct body{
+    char *path;
+    char *p;
+    size_t len;
+} *bodies;
+static int nbodies;
+
+static void
+setbody(struct tmpl *t, char *path)
+{
+    struct body *b;
+    struct stat st;
+    int i, fd;
+
+    for(i=0; i<nbodies; i++)
+        if(strcmp(bodies[i].path, path) == 0)
+            break;
+    if(i == nbodies){
+        bodies = remal(bodies, (nbodies+1) * sizeof(*bodies));
+        b = &bodies[nbodies++];
+        b->path = strdup(path);
+        if((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+            panic("open %s: %s", path, strerror(errno));
+        b->len = st.st_size;
+        b->p = "";
+        if(b->len > 0){
+            // in memory up front, so that sending never waits on the disk
+            b->p = mmap(nil, b->len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+            if(b->p == MAP_FAILED)
+                panic("mmap %s: %s", path, strerror(errno));
+        }
+        close(fd);
+    }
+    t->body = bodies[i].p;
+    t->bodylen = bodies[i].len;
+}
+
+static struct tmpl *
+newtmpl(char *method, char *path, double weight)
+{
+    struct tmpl *t;
+    int i;
+
+    tmpls = remal(tmpls, (ntmpls+1) * sizeof(*tmpls));
+    t = &tmpls[ntmpls++];
+    memset(t, 0, sizeof(*t));
+    t->method = strdup(method);
+    t->path = strdup(path);
+    t->weight = weight;
+    t->evcmd = -1;
+    t->nobody = strcmp(method, "HEAD") == 0;
+    for(i=0; i<sizeof(methods)/sizeof(methods[0]); i++)
+        if(strcmp(method, methods[i].name) == 0)
+            t->evcmd = methods[i].cmd;
+    return t;
+}
+
+static void
+addhdr(struct tmpl *t, char *hdr)
+{
+    char *v;
+
+    if((v = strchr(hdr, ':')) == nil || v == hdr)
+        panic("template %d: bad header \"%s\"", ntmpls, hdr);
+    *v++ = '\0';
+    v += strspn(v, " ");
+
+    t->keys = remal(t->keys, (t->nhdrs+1) * sizeof(char *));
+    t->vals = remal(t->vals, (t->nhdrs+1) * sizeof(char *));
+    t->keys[t->nhdrs] = strdup(hdr);
+    t->vals[t->nhdrs] = strdup(v);
+    t->nhdrs++;
+    if(strcasecmp(hdr, "Host") == 0)
+        t->hashost = 1;
+    if(strcasecmp(hdr, "Content-Length") == 0)
+        t->haslen = 1;
+}
+
+static void
+loadtmpls(char *file)
+{
+    FILE *f;
+    struct tmpl *t;
+    char *line, *fld[64], *p, *e;
+    size_t len;
+    double weight;
+    int i, n, lineno;
+
+    if((f = fopen(file, "r")) == nil)
+        panic("open %s: %s", file, strerror(errno));
+
+    for(lineno=1; (line = xfgetln(f, &len)) != nil; lineno++){
+        line[strcspn(line, "\r\n")] = '\0';
+        if(line[0] == '\0' || line[0] == '#')
+            continue;
+
+        n = 0;
+        for(p=line; n<sizeof(fld)/sizeof(fld[0]) && (e = strsep(&p, "\t")) != nil;)
+            if(*e != '\0')
+                fld[n++] = e;
+
+        // a weight is digits and a point, so no method is taken for one
+        i = 0;
+        weight = 1;
+        if(n > 0 && fld[0][strspn(fld[0], "0123456789.")] == '\0'){
+            weight = strtod(fld[0], &e);
+            if(e == fld[0] || *e != '\0' || !isfinite(weight))
+                weight = -1;
+            i = 1;
+        }
+        if(n - i < 2 || weight < 0)
+            panic("%s:%d: want [WEIGHT] METHOD PATH [HEADER]... [@BODY]", file, lineno);
+
+        t = newtmpl(fld[i], fld[i+1], weight);
+        for(i+=2; i<n; i++){
+            if(fld[i][0] == '@')
+                setbody(t, fld[i]+1);
+            else
+                addhdr(t, fld[i]);
+        }
+    }
+    fclose(f);
+
+    if(ntmpls == 0)
+        panic("%s: no templates", file);
+}
+
+/* the request, as the raw engines write it */
+static void
+serialize(struct tmpl *t)
+{
+    int i, n;
+    char *p;
+
+    n = strlen(t->method) + strlen(t->path) + strlen(http_hosthdr) + 96;
+    for(i=0; i<t->nhdrs; i++)
+        n += strlen(t->keys[i]) + strlen(t->vals[i]) + 4;
+
+    t->raw = p = mal(n);
+    p += sprintf(p, "%s %s HTTP/1.1\r\n", t->method, t->path);
+    if(!t->hashost)
+        p += sprintf(p, "Host: %s\r\n", http_hosthdr);
+    for(i=0; i<t->nhdrs; i++)
+        p += sprintf(p, "%s: %s\r\n", t->keys[i], t->vals[i]);
+    if(t->body != nil && !t->haslen)
+        p += sprintf(p, "Content-Length: %zu\r\n", t->bodylen);
+    p += sprintf(p, "\r\n");
+    t->rawlen = p - t->raw;
+}
+
+/* headers that are about an HTTP/1.1 connection, which HTTP/2 does without */
+static char *h1only[] = {
+    "host", "connection", "keep-alive", "proxy-connection", "transfer-encoding", "upgrade", "te",
+};
+
+/*
+    The request as -E h2 writes it: a HEADERS frame, all of whose
+    fields are literals that are not indexed, so that it is the same
+    on every connection. h2.c fills in the flags and the stream.
+*/
+static void
+serialize2(struct tmpl *t)
+{
+    unsigned char *p;
+    char *authority, *k, len[32];
+    int i, j, n;
+
+    authority = http_hosthdr;
+    n = strlen(t->method) + strlen(t->path) + strlen(http_hosthdr) + 128;
+    for(i=0; i<t->nhdrs; i++){
+        n += strlen(t->keys[i]) + strlen(t->vals[i]) + 12;
+        if(strcasecmp(t->keys[i], "Host") == 0)
+            authority = t->vals[i];
+    }
+
+    t->raw = mal(n);
+    p = (unsigned char *)t->raw + H2hdrlen;
+    p += hpackfield(p, ":method", t->method);
+    p += hpackfield(p, ":scheme", "http");
+    p += hpackfield(p, ":authority", authority);
+    p += hpackfield(p, ":path", t->path);
+    for(i=0; i<t->nhdrs; i++){
+        k = strdup(t->keys[i]);
+        for(j=0; k[j]!='\0'; j++)
+            k[j] = tolower(k[j]);
+        for(j=0; j<sizeof(h1only)/sizeof(h1only[0]); j++)
+            if(strcmp(k, h1only[j]) == 0)
+                break;
+        if(j == sizeof(h1only)/sizeof(h1only[0]))
+            p += hpackfield(p, k, t->vals[i]);
+        free(k);
+    }
+    if(t->body != nil && !t->haslen){
+        snprintf(len, sizeof(len), "%zu", t->bodylen);
+        p += hpackfield(p, "content-length", len);
+    }
+    t->rawlen = (char *)p - t->raw;
+    if(t->rawlen - H2hdrlen > H2minframe)
+        panic("template %d: too many headers for one HTTP/2 frame", (int)(t - tmpls));
+    h2put((unsigned char *)t->raw, t->rawlen - H2hdrlen, H2headers, H2endheaders, 0);
+}
+
+/*
+    Vose: scale the weights to average 1, then repeatedly pair a
+    column under 1 with one over, topping the small one up from
+    the large one, which becomes its alias.
+*/
+static void
+mkalias(void)
+{
+    double total, *p;
+    int *small, *large, ns, nl, s, l, i;
+
+    prob = mal(ntmpls * sizeof(double));
+    alias = mal(ntmpls * sizeof(int));
+    small = mal(ntmpls * sizeof(int));
+    large = mal(ntmpls * sizeof(int));
+
+    total = 0;
+    for(i=0; i<ntmpls; i++)
+        total += tmpls[i].weight;
+    if(total <= 0)
+        panic("templates: weights add up to nothing");
+
+    p = prob;
+    ns = nl = 0;
+    for(i=0; i<ntmpls; i++){
+        p[i] = tmpls[i].weight * ntmpls / total;
+        alias[i] = i;
+        if(p[i] < 1)
+            small[ns++] = i;
+        else
+            large[nl++] = i;
+    }
+    while(ns > 0 && nl > 0){
+        s = small[--ns];
+        l = large[--nl];
+        alias[s] = l;
+        p[l] -= 1 - p[s];
+        if(p[l] < 1)
+            small[ns++] = l;
+        else
+            large[nl++] = l;
+    }
+    // what is left is 1 but for rounding
+    while(nl > 0)
+        p[large[--nl]] = 1;
+    while(ns > 0)
+        p[small[--ns]] = 1;
+
+    free(small);
+    free(large);
+}
+
+/* the templates from file, or if nil the one given by -m, -u and -d */
+void
+mktmpls(char *file)
+{
+    struct tmpl *t;
+    char *method;
+    int i;
+
+    if(file != nil)
+        loadtmpls(file);
+    else{
+        if((method = params.method) == nil)
+            method = params.bodyfile != nil ? "POST" : "GET";
+        t = newtmpl(method, params.path, 1);
+        if(params.bodyfile != nil)
+            setbody(t, params.bodyfile);
+    }
+
+    for(i=0; i<ntmpls; i++){
+        if(engine == &evhttpengine && tmpls[i].evcmd < 0)
+            panic("template %d: evhttp cannot send %s; use -E raw", i, tmpls[i].method);
+        if(engine == &h2engine)
+            serialize2(&tmpls[i]);
+        else
+            serialize(&tmpls[i]);
+    }
+    mkalias();
+}
+
+int
+picktmpl(worker *w)
+{
+    double x;
+    int i;
+
+    if(ntmpls == 1)
+        return 0;
+    x = erand48(w->xsubi) * ntmpls;
+    i = (int)x;
+    return x - i < prob[i] ? i : alias[i];
+}
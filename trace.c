@@ -0,0 +1,279 @@
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "u.h"
+#include "trace.h"
+
+static char magic[8] = "htrace1\n";
+
+typedef struct Tbuf Tbuf;
+struct Tbuf{
+	Tbuf		*next;
+	Trace		*t;
+	int		len;
+	int		n;
+	uint64_t	t0;
+	uint64_t	prev;
+	unsigned char	buf[Tblock];
+};
+
+struct Trace{
+	int	fd;
+	char	*path;
+	Tbuf	*cur;
+	Tbuf	*free;	/* written, ready for reuse */
+	int	nbusy;	/* queued or being written */
+};
+
+/*
+	The writer. Every trace in the process shares one queue and
+	one thread, started with the first trace; a forked worker
+	starts its own.
+*/
+static pthread_mutex_t lk = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t written = PTHREAD_COND_INITIALIZER;
+static Tbuf *qhead, *qtail;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+static void *
+writer(void *arg)
+{
+	Tbuf *b;
+	Trace *t;
+
+	for(;;){
+		pthread_mutex_lock(&lk);
+		while(qhead == nil)
+			pthread_cond_wait(&queued, &lk);
+		b = qhead;
+		if((qhead = b->next) == nil)
+			qtail = nil;
+		pthread_mutex_unlock(&lk);
+
+		t = b->t;
+		if(atomicio(write, t->fd, b->buf, b->len) != b->len)
+			panic("write %s: %s", t->path, strerror(errno));
+
+		pthread_mutex_lock(&lk);
+		b->next = t->free;
+		t->free = b;
+		t->nbusy--;
+		pthread_cond_broadcast(&written);
+		pthread_mutex_unlock(&lk);
+	}
+	return nil;
+}
+
+static void
+startwriter(void)
+{
+	pthread_t tid;
+
+	if(pthread_create(&tid, nil, writer, nil) != 0)
+		panic("pthread_create");
+	pthread_detach(tid);
+}
+
+static void
+put32(unsigned char *p, uint32_t v)
+{
+	int i;
+
+	for(i=0; i<4; i++)
+		p[i] = v >> 8*i;
+}
+
+static void
+put64(unsigned char *p, uint64_t v)
+{
+	int i;
+
+	for(i=0; i<8; i++)
+		p[i] = v >> 8*i;
+}
+
+static uint64_t
+get64(unsigned char *p, int n)
+{
+	uint64_t v;
+	int i;
+
+	v = 0;
+	for(i=0; i<n; i++)
+		v |= (uint64_t)p[i] << 8*i;
+	return v;
+}
+
+static unsigned char *
+putvarint(unsigned char *p, uint64_t v)
+{
+	while(v >= 0x80){
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+static unsigned char *
+getvarint(unsigned char *p, unsigned char *e, uint64_t *v)
+{
+	int s;
+
+	*v = 0;
+	for(s=0; p<e && s<64; s+=7){
+		*v |= (uint64_t)(*p & 0x7f) << s;
+		if((*p++ & 0x80) == 0)
+			return p;
+	}
+	return nil;
+}
+
+/* hand the current block to the writer, waiting if too many are */
+static void
+ship(Trace *t)
+{
+	Tbuf *b = t->cur;
+
+	put32(b->buf, b->len - Thdr);
+	put32(b->buf+4, b->n);
+	put64(b->buf+8, b->t0);
+
+	pthread_mutex_lock(&lk);
+	b->next = nil;
+	if(qtail != nil)
+		qtail->next = b;
+	else
+		qhead = b;
+	qtail = b;
+	t->nbusy++;
+	pthread_cond_signal(&queued);
+
+	while(t->free == nil && t->nbusy >= Tqueue)
+		pthread_cond_wait(&written, &lk);
+	if((b = t->free) != nil)
+		t->free = b->next;
+	pthread_mutex_unlock(&lk);
+
+	if(b == nil){
+		b = mal(sizeof(*b));
+		b->t = t;
+	}
+	b->len = Thdr;
+	b->n = 0;
+	t->cur = b;
+}
+
+Trace *
+mktrace(char *path)
+{
+	Trace *t;
+
+	pthread_once(&once, startwriter);
+
+	t = mal(sizeof(*t));
+	memset(t, 0, sizeof(*t));
+	t->path = strdup(path);
+	if((t->fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666)) < 0)
+		panic("open %s: %s", path, strerror(errno));
+	if(write(t->fd, magic, sizeof(magic)) != sizeof(magic))
+		panic("write %s: %s", path, strerror(errno));
+
+	t->cur = mal(sizeof(*t->cur));
+	t->cur->t = t;
+	t->cur->len = Thdr;
+	t->cur->n = 0;
+	return t;
+}
+
+void
+tracerec(Trace *t, uint64_t start, uint64_t end, int how, uint64_t connect, uint64_t ttfb)
+{
+	Tbuf *b = t->cur;
+	unsigned char *p;
+	int64_t d;
+
+	if(b->len + Tmaxrec > Tblock){
+		ship(t);
+		b = t->cur;
+	}
+	if(b->n == 0)
+		b->t0 = b->prev = start;
+
+	d = start - b->prev;
+	p = b->buf + b->len;
+	p = putvarint(p, (uint64_t)d << 1 ^ (uint64_t)(d >> 63));
+	p = putvarint(p, end - start);
+	p = putvarint(p, how);
+	p = putvarint(p, connect);
+	p = putvarint(p, ttfb);
+	b->len = p - b->buf;
+	b->prev = start;
+	b->n++;
+}
+
+/* write out what is left and wait for it */
+void
+traceclose(Trace *t)
+{
+	if(t->cur->n > 0)
+		ship(t);
+
+	pthread_mutex_lock(&lk);
+	while(t->nbusy > 0)
+		pthread_cond_wait(&written, &lk);
+	pthread_mutex_unlock(&lk);
+	close(t->fd);
+}
+
+/*
+	Call fn for each record in the trace f. Returns 0 at the end
+	of the trace, or -1 if it is not one or is cut short.
+*/
+int
+tracescan(FILE *f, Tracefn *fn, void *arg)
+{
+	unsigned char hdr[Thdr], *buf, *p, *e;
+	uint64_t prev, d, len, v[5];
+	int i, n;
+
+	if(fread(hdr, 1, sizeof(magic), f) != sizeof(magic)
+	|| memcmp(hdr, magic, sizeof(magic)) != 0)
+		return -1;
+
+	buf = mal(Tblock);
+	for(;;){
+		if((n = fread(hdr, 1, Thdr, f)) == 0)
+			break;
+		len = get64(hdr, 4);
+		if(n != Thdr || len > Tblock - Thdr || fread(buf, 1, len, f) != len)
+			goto bad;
+
+		n = get64(hdr+4, 4);
+		prev = get64(hdr+8, 8);
+		p = buf;
+		e = buf + len;
+		while(n-- > 0){
+			for(i=0; i<5; i++)
+				if((p = getvarint(p, e, &v[i])) == nil)
+					goto bad;
+			d = v[0];
+			prev += (d >> 1) ^ -(d & 1);
+			fn(arg, prev, prev + v[1], v[2], v[3], v[4]);
+		}
+	}
+	free(buf);
+	return 0;
+
+bad:
+	free(buf);
+	return -1;
+}
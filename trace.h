@@ -0,0 +1,34 @@
+/*
+	Binary per-request traces.
+
+	A trace file is the 8 bytes "htrace1\n" followed by blocks,
+	each of which decodes on its own:
+
+		len[4] n[4] t0[8]	little-endian header
+		n records, len bytes
+
+	A record is five varints (7 bits a byte, low bits first):
+	the start time in microseconds, zigzag-encoded as a difference
+	from the previous record's start (t0 for the first in a block);
+	the end time, as a difference from the start; how the request
+	ended (Success, Error, ...); and the connect and first byte
+	times, also from the start, 0 if there were none.
+
+	Records are encoded into a block in memory. Full blocks go to
+	a writer thread, one per process, which does the writes.
+*/
+
+enum{
+	Tblock = 1<<16,		/* bytes in a block, header included */
+	Thdr = 16,
+	Tmaxrec = 5*10,		/* the longest a record can encode to */
+	Tqueue = 16,		/* blocks a trace may have waiting to be written */
+};
+
+typedef struct Trace Trace;
+typedef void Tracefn(void *arg, uint64_t start, uint64_t end, int how, uint64_t connect, uint64_t ttfb);
+
+Trace *mktrace(char *path);
+void tracerec(Trace *t, uint64_t start, uint64_t end, int how, uint64_t connect, uint64_t ttfb);
+void traceclose(Trace *t);
+int tracescan(FILE *f, Tracefn *fn, void *arg);
@@ -77,7 +77,7 @@ remal(void *p, size_t siz)
 {
 	void *p1;
 	p1 = realloc(p, siz);
-	if(p==nil)
+	if(p1==nil)
 		panic("realloc");
 	return p1;
 }
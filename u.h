@@ -1,6 +1,6 @@
 #define nil NULL
 
-void panic(const char *fmt, ...);
+void panic(const char *fmt, ...) __attribute__((noreturn));
 void say(const char *fmt, ...);
 void Scp(char *dst, char *src, size_t n);
 ssize_t atomicio(ssize_t (f)(), int fd, void *_s, size_t n);
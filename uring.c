@@ -0,0 +1,236 @@
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <event.h>
+#include <linux/io_uring.h>
+
+#include "u.h"
+#include "uring.h"
+
+enum{
+	Nsq = 256,	/* a full submission queue is flushed early */
+};
+
+struct Uring{
+	int		fd;
+	int		efd;
+	struct event	ev;	/* efd: completions are waiting */
+	struct event	subev;	/* made active when there is something to submit */
+	int		due;
+
+	unsigned	*sqtail;
+	unsigned	*sqflags;
+	unsigned	*sqarray;
+	unsigned	sqmask;
+	unsigned	sqn;
+	struct io_uring_sqe *sqes;
+	unsigned	tail;	/* ours, published on submit */
+	unsigned	nq;	/* queued since the last submit */
+
+	unsigned	*cqhead;
+	unsigned	*cqtail;
+	unsigned	cqmask;
+	struct io_uring_cqe *cqes;
+
+	Uringfn		*fn;
+	void		*arg;
+};
+
+static int
+setup(unsigned n, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, n, p);
+}
+
+static int
+enter(int fd, unsigned nsubmit, unsigned nwait, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, nsubmit, nwait, flags, nil, 0);
+}
+
+static int
+reg(int fd, unsigned op, void *arg, unsigned n)
+{
+	return syscall(__NR_io_uring_register, fd, op, arg, n);
+}
+
+/*
+	Why io_uring will not do here, or nil if it will: the kernel
+	must let us set up a ring and support the opcodes we use.
+*/
+char *
+uringprobe(void)
+{
+	static int ops[] = { IORING_OP_CONNECT, IORING_OP_RECV, IORING_OP_WRITEV };
+	struct io_uring_params p;
+	struct io_uring_probe *pr;
+	char *why;
+	int fd, i;
+
+	memset(&p, 0, sizeof(p));
+	if((fd = setup(4, &p)) < 0)
+		return strerror(errno);
+
+	why = nil;
+	pr = mal(sizeof(*pr) + 256*sizeof(struct io_uring_probe_op));
+	memset(pr, 0, sizeof(*pr) + 256*sizeof(struct io_uring_probe_op));
+	if(!(p.features & IORING_FEAT_NODROP) || reg(fd, IORING_REGISTER_PROBE, pr, 256) < 0)
+		why = "kernel too old";
+	for(i=0; why == nil && i<sizeof(ops)/sizeof(ops[0]); i++){
+		if(ops[i] > pr->last_op || !(pr->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+			why = "kernel too old";
+	}
+	free(pr);
+	close(fd);
+	return why;
+}
+
+static void
+submit(Uring *u)
+{
+	int n;
+
+	__atomic_store_n(u->sqtail, u->tail, __ATOMIC_RELEASE);
+	while(u->nq > 0){
+		if((n = enter(u->fd, u->nq, 0, 0)) < 0){
+			if(errno == EINTR)
+				continue;
+			panic("io_uring_enter: %s", strerror(errno));
+		}
+		u->nq -= n;
+	}
+}
+
+static void
+submitcb(int fd, short what, void *arg)
+{
+	Uring *u = arg;
+
+	u->due = 0;
+	submit(u);
+}
+
+static void
+reapcb(int fd, short what, void *arg)
+{
+	Uring *u = arg;
+	struct io_uring_cqe *cqe;
+	unsigned head, tail;
+	uint64_t v, data;
+	int res;
+
+	if(read(u->efd, &v, sizeof(v)) < 0 && errno != EAGAIN)
+		panic("read eventfd: %s", strerror(errno));
+
+	head = *u->cqhead;
+	for(;;){
+		tail = __atomic_load_n(u->cqtail, __ATOMIC_ACQUIRE);
+		if(head == tail){
+			// completions the queue had no room for
+			if(!(__atomic_load_n(u->sqflags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW))
+				break;
+			enter(u->fd, 0, 0, IORING_ENTER_GETEVENTS);
+			continue;
+		}
+		cqe = &u->cqes[head & u->cqmask];
+		data = cqe->user_data;
+		res = cqe->res;
+		__atomic_store_n(u->cqhead, ++head, __ATOMIC_RELEASE);
+		u->fn(u->arg, data, res);
+	}
+}
+
+static void *
+ringmap(int fd, size_t n, off_t off)
+{
+	void *p;
+
+	p = mmap(nil, n, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, off);
+	if(p == MAP_FAILED)
+		panic("mmap io_uring: %s", strerror(errno));
+	return p;
+}
+
+/* a ring for about n operations in flight at once */
+Uring *
+mkuring(struct event_base *base, int n, Uringfn *fn, void *arg)
+{
+	struct io_uring_params p;
+	Uring *u;
+	char *sq, *cq;
+
+	u = mal(sizeof(*u));
+	memset(u, 0, sizeof(*u));
+	u->fn = fn;
+	u->arg = arg;
+
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+	p.cq_entries = n > 2*Nsq ? n : 2*Nsq;
+	if((u->fd = setup(Nsq, &p)) < 0)
+		panic("io_uring_setup: %s", strerror(errno));
+
+	sq = ringmap(u->fd, p.sq_off.array + p.sq_entries*sizeof(unsigned), IORING_OFF_SQ_RING);
+	cq = ringmap(u->fd, p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe), IORING_OFF_CQ_RING);
+	u->sqes = ringmap(u->fd, p.sq_entries*sizeof(struct io_uring_sqe), IORING_OFF_SQES);
+
+	u->sqtail = (unsigned *)(sq + p.sq_off.tail);
+	u->sqflags = (unsigned *)(sq + p.sq_off.flags);
+	u->sqarray = (unsigned *)(sq + p.sq_off.array);
+	u->sqmask = *(unsigned *)(sq + p.sq_off.ring_mask);
+	u->sqn = p.sq_entries;
+	u->tail = *u->sqtail;
+
+	u->cqhead = (unsigned *)(cq + p.cq_off.head);
+	u->cqtail = (unsigned *)(cq + p.cq_off.tail);
+	u->cqmask = *(unsigned *)(cq + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	if((u->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+		panic("eventfd: %s", strerror(errno));
+	if(reg(u->fd, IORING_REGISTER_EVENTFD, &u->efd, 1) < 0)
+		panic("io_uring_register: %s", strerror(errno));
+
+	event_set(&u->ev, u->efd, EV_READ | EV_PERSIST, reapcb, u);
+	event_base_set(base, &u->ev);
+	event_add(&u->ev, nil);
+	event_set(&u->subev, -1, 0, submitcb, u);
+	event_base_set(base, &u->subev);
+
+	return u;
+}
+
+/*
+	The next free submission entry, zeroed. It goes to the kernel
+	with everything else queued in this pass of the event loop.
+*/
+struct io_uring_sqe *
+uringsqe(Uring *u)
+{
+	struct io_uring_sqe *sqe;
+	unsigned i;
+
+	if(u->nq == u->sqn)
+		submit(u);
+
+	i = u->tail & u->sqmask;
+	sqe = &u->sqes[i];
+	memset(sqe, 0, sizeof(*sqe));
+	u->sqarray[i] = i;
+	u->tail++;
+	u->nq++;
+
+	if(!u->due){
+		u->due = 1;
+		event_active(&u->subev, EV_WRITE, 1);
+	}
+	return sqe;
+}
@@ -0,0 +1,19 @@
+/*
+	A minimal io_uring, driven from a libevent loop.
+
+	Entries taken with uringsqe go to the kernel together in one
+	io_uring_enter once the callbacks already due in this pass of
+	the loop have run. The kernel posts completions to an eventfd
+	the loop watches; each is handed to the ring's function along
+	with the user data it was submitted with.
+
+	Callers include <stdint.h>, <event.h> and <linux/io_uring.h>
+	first.
+*/
+
+typedef struct Uring Uring;
+typedef void Uringfn(void *arg, uint64_t data, int res);
+
+char *uringprobe(void);
+Uring *mkuring(struct event_base *base, int n, Uringfn *fn, void *arg);
+struct io_uring_sqe *uringsqe(Uring *u);
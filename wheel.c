@@ -0,0 +1,133 @@
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <event.h>
+
+#include "u.h"
+#include "clk.h"
+#include "wheel.h"
+
+struct Wheel{
+	struct event	ev;
+	int		armed;
+	uint64_t	tick;
+	uint64_t	done;	/* the slots for ticks before this have run */
+	int		n;
+	Wentry		*slot[Wslots];
+	Wheelfn		*fn;
+	void		*arg;
+};
+
+static void
+wlink(Wentry **l, Wentry *e)
+{
+	if((e->next = *l) != nil)
+		e->next->prev = &e->next;
+	e->prev = l;
+	*l = e;
+}
+
+static void
+wunlink(Wentry *e)
+{
+	if(e->next != nil)
+		e->next->prev = e->prev;
+	*e->prev = e->next;
+	e->prev = nil;
+}
+
+static void
+arm(Wheel *w)
+{
+	struct timeval tv;
+	uint64_t now, next, wait;
+
+	now = clk();
+	next = (w->done+1) * w->tick;
+	wait = next > now ? next - now : 0;
+	tv.tv_sec = wait / 1000000;
+	tv.tv_usec = wait % 1000000;
+	evtimer_add(&w->ev, &tv);
+	w->armed = 1;
+}
+
+/*
+	Run the slot for each tick that has gone by. Each is taken off
+	the wheel first, so that fn can add and delete entries as it
+	likes; any not due yet (added a lap or more ahead) go back on.
+*/
+static void
+tickcb(int fd, short what, void *arg)
+{
+	Wheel *w = arg;
+	Wentry *l, *e;
+	uint64_t now;
+	int i;
+
+	clkstale();
+	now = clk();
+	w->armed = 0;
+
+	for(i=0; i<Wslots && (w->done+1)*w->tick <= now; i++){
+		if((l = w->slot[w->done % Wslots]) != nil){
+			w->slot[w->done % Wslots] = nil;
+			l->prev = &l;
+		}
+		w->done++;
+		while((e = l) != nil){
+			wunlink(e);
+			if(e->when <= now){
+				w->n--;
+				w->fn(w->arg, e);
+			}else
+				wlink(&w->slot[e->when / w->tick % Wslots], e);
+		}
+	}
+	// a whole lap has been looked at, so nothing else is due
+	if((w->done+1)*w->tick <= now)
+		w->done = now / w->tick;
+
+	if(w->n > 0)
+		arm(w);
+}
+
+Wheel *
+mkwheel(struct event_base *base, uint64_t span, Wheelfn *fn, void *arg)
+{
+	Wheel *w;
+
+	w = mal(sizeof(*w));
+	memset(w, 0, sizeof(*w));
+	w->tick = (span + Wslots-1) / Wslots;
+	if(w->tick < Wmintick)
+		w->tick = Wmintick;
+	w->fn = fn;
+	w->arg = arg;
+	evtimer_set(&w->ev, tickcb, w);
+	event_base_set(base, &w->ev);
+	return w;
+}
+
+void
+wheeladd(Wheel *w, Wentry *e, uint64_t when)
+{
+	e->when = when;
+	wlink(&w->slot[when / w->tick % Wslots], e);
+	if(w->n++ == 0 && !w->armed){
+		// empty, so there is nothing behind this to run
+		w->done = clk() / w->tick;
+		arm(w);
+	}
+}
+
+void
+wheeldel(Wheel *w, Wentry *e)
+{
+	if(e->prev == nil)
+		return;
+	wunlink(e);
+	w->n--;
+}
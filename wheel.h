@@ -0,0 +1,31 @@
+/*
+	A hashed timing wheel, for many timeouts of about the same
+	length. Adding and deleting an entry is a list insert or
+	unlink; the wheel costs one libevent timer, rearmed each tick
+	while anything is on it, however many entries it holds.
+
+	Times are clk microseconds. An entry fires within a tick
+	(span/Wslots, but at least Wmintick) after it is due. Entries
+	due more than span ahead work, but are looked at once a lap.
+*/
+
+enum{
+	Wslots = 256,
+	Wmintick = 1000,
+};
+
+typedef struct Wheel Wheel;
+typedef struct Wentry Wentry;
+
+struct Wentry{
+	Wentry		*next;
+	Wentry		**prev;		/* nil when not on the wheel */
+	uint64_t	when;
+};
+
+/* called with e already off the wheel */
+typedef void Wheelfn(void *arg, Wentry *e);
+
+Wheel *mkwheel(struct event_base *base, uint64_t span, Wheelfn *fn, void *arg);
+void wheeladd(Wheel *w, Wentry *e, uint64_t when);
+void wheeldel(Wheel *w, Wentry *e);